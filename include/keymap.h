@@ -24,39 +24,61 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#ifndef BTREE_H
-#define BTREE_H
+#ifndef KEYMAP_H
+#define KEYMAP_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-typedef unsigned long long BTKey;
+// a file (device and inode)
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+} KMKey;
 
-typedef struct BTNode {
-  BTKey key;
+// a slot is free if it has no value and inode 0 (never used), removed if it has
+// no value but a key
+typedef struct {
+  KMKey key;
   void* value;
+} KMSlot;
 
-  struct BTNode* left;
-  struct BTNode* right;
-} BTNode;
+// map of files to values (open addressing, linear probing)
+typedef struct {
+  KMSlot* slots;
+  size_t  cap;                       // slots (a power of 2)
+  size_t  n;                         // keys with a value
+  size_t  used;                      // slots taken (by removed keys too)
+} KeyMap;
 
 
-// create a new btree
-BTNode* btree_new(BTKey key);
+// create a new map
+KeyMap* keymap_new(void);
+
+// insert a value (NULL removes the key, the value it had is not freed)
+void  keymap_set(KeyMap* map, KMKey key, void* val);
 
-// insert a value
-void  btree_set(BTNode* root, BTKey key, void* val);
 // retrieve value by key
-void* btree_get(const BTNode* root, BTKey key);
+void* keymap_get(const KeyMap* map, KMKey key);
 
 // check if a key exists
-bool btree_has_key(const BTNode* root, BTKey key);
+bool keymap_has_key(const KeyMap* map, KMKey key);
+
+// call f on all keys, the value it returns replaces the old one (NULL removes the key)
+void keymap_traverse(KeyMap* map, void* (*f)(KMKey key, void* val, void* ctx), void* ctx);
+
+// number of keys
+size_t keymap_size(const KeyMap* map);
 
-// traverse tree
-void btree_traverse(BTNode* root, void* (*f)(BTKey key, void* val, void* ctx), void* ctx);
+// make room for n more keys (adding them won't rehash), returns false if there's no memory for it
+bool keymap_reserve(KeyMap* map, size_t n);
 
-// combine two keys into one
-BTKey btree_cantor(BTKey k1, BTKey k2);
+// key of a file
+static inline KMKey keymap_key(uint64_t dev, uint64_t ino) {
+  return (KMKey) { dev, ino };
+}
 
-// free btree
-void btree_free(BTNode* root);
+// free map (and the values in it if values)
+void keymap_free(KeyMap* map, bool values);
 #endif
@@ -27,10 +27,11 @@
 #ifndef RAIDER_H
 #define RAIDER_H
 
-#include "btree.h"
+#include "keymap.h"
 
 #include <dirent.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #if defined(__NetBSD__)
@@ -55,6 +56,9 @@
 
 #define RAIDER_VERSION "0.5.1"
 
+// longest filter query
+#define FILTER_QUERY_MAX 63
+
 // color pairs
 #define PAIR_DEFAULT       1
 #define PAIR_RED_BLACK     2
@@ -75,17 +79,67 @@ typedef struct {
 } Config;
 
 // file types
-typedef enum { unknown, text, document, image, video, archive, file_type_num } FileType;
+typedef enum { unknown, text, code, document, image, video, audio, archive, file_type_num } FileType;
+
+// file type names
+extern const char FILE_TYPES[file_type_num][10];
+
+// file metadata (the stat fields raider uses)
+typedef struct {
+  uint64_t    dev;               // device
+  uint64_t    ino;               // inode
+  int64_t     size;              // size in bytes
+  int64_t     ctime;             // status change time
+  uint32_t    mode;              // type and permissions
+  uint32_t    uid;               // owner
+  uint32_t    gid;               // group
+} EntryInfo;
 
 // file description
 typedef struct {
-  char        name[NAME_MAX+1];  // file name
-  char        ext[10];           // extension
+  const char* name;              // file name (interned in the listing arena)
+  EntryInfo   info;              // file info
   FileType    type;              // content type (guessed from extension)
-  struct stat info;              // file info
+  uint8_t     ext;               // offset of the extension in the last component of name
+  uint8_t     dtype;             // type reported by the directory (DT_*)
   bool        is_link;           // if it is a symbolic link
+  bool        loaded;            // if info has been loaded (metadata is loaded lazily)
 } Entry;
 
+// one pass directory reader
+typedef struct {
+  int     fd;
+#ifdef __linux__
+  char*   buf;
+  size_t  len;
+  size_t  off;
+#else
+  DIR*    dir;
+#endif
+} DirReader;
+
+// directory listing (private to ls.c)
+typedef struct Listing Listing;
+
+// gives the entries of a virtual listing: 1 and the next one, 0 if there are none
+// yet, -1 when there are no more
+typedef int (*ListSource)(const char** name, unsigned char* type);
+
+// metadata query (private to query.c)
+typedef struct Query Query;
+
+// listing cache counters
+typedef struct {
+  size_t  listings;              // cached listings
+  size_t  bytes;                 // memory they take
+  size_t  max_bytes;             // memory cap
+  size_t  hits;                  // directories shown from the cache
+  size_t  misses;                // directories read again
+  size_t  invalidated;           // listings dropped because their directory changed
+  size_t  evicted;               // listings dropped to stay within the cap
+  size_t  prefetched;            // listings read ahead of time
+} ListCacheStats;
+
 // the current state
 typedef struct {
   size_t start_pos;
@@ -132,12 +186,259 @@ typedef struct {
 // initializes curses
 void init_curses(void);
 
-// read directory
+// open directory for reading
+int dir_reader_open(DirReader* reader, const char* path);
+
+// read an open directory (the reader takes over fd)
+int dir_reader_open_fd(DirReader* reader, int fd);
+
+// get next directory entry (skips . and ..), returns false when done
+bool dir_reader_next(DirReader* reader, const char** name, unsigned char* type);
+
+// close directory reader
+void dir_reader_close(DirReader* reader);
+
+// read directory (recently left directories come back from the listing cache
+// if they have not changed)
 int list_dir(const char* path);
 
-// sort directory
+// list the entries a source gives as if they were in directory path (their names
+// are paths relative to it), label tells what they are (it must stay there while
+// listed), they're streamed in like huge directories and never cached
+int list_dir_virtual(const char* path, ListSource source, const char* label);
+
+// get the label of the virtual listing shown (NULL if a directory is shown)
+const char* list_dir_label(void);
+
+// get the extension of an entry ("" if it has none)
+const char* entry_ext(const Entry* entry);
+
+// get entry at position pos (in sort order)
+Entry* entry_at(size_t pos);
+
+// get the position of the entry named name (def if it isn't shown)
+size_t list_dir_find(const char* name, size_t def);
+
+// show only the entries at these positions, in this order (NULL to show all of them)
+void list_dir_filter(const uint32_t* pos);
+
+// free listing buffers (and cached listings)
+void list_dir_free(void);
+
+// drop cached listings watched by wd, the current one won't be cached (all of them if wd is -1)
+void list_cache_invalidate(int wd);
+
+// check if the current listing holds watch wd
+bool list_dir_watching(int wd);
+
+// get listing cache counters
+void list_cache_stats(ListCacheStats* stats);
+
+// get up to max names of a cached directory in sort order (without reading it),
+// returns the number of names or -1 if it's not in the cache
+int list_cache_peek(const char* path, size_t max, const char* names[max]);
+
+// start reading a directory ahead of time (the one being read before is dropped),
+// returns false if there's nothing to read (it's listed or cached already)
+bool list_prefetch(const char* path);
+
+// read up to max more names of the directory being read ahead (it's cached once
+// complete), returns false when it's done
+bool list_prefetch_step(size_t max);
+
+// check if a directory is being read ahead
+bool list_prefetching(void);
+
+// drop the directory being read ahead
+void list_prefetch_cancel(void);
+
+// check if the directory is still being read (huge directories are streamed in)
+bool list_dir_reading(void);
+
+// read up to max more names and merge them into the sorted entries, pos is moved
+// along with the entry it points to, returns the number of entries shown
+size_t list_dir_read_more(size_t max, size_t* pos);
+
+// load metadata of entries in [from, to) that don't have it yet
+void list_dir_load(size_t from, size_t to);
+
+// load metadata for up to max pending entries, returns how many are still pending
+size_t list_dir_load_pending(size_t max);
+
+// number of entries still waiting for metadata
+size_t list_dir_pending(void);
+
+// queue a change to an entry of the current directory
+void list_dir_change(const char* name, bool removed);
+
+// number of changes waiting to be applied
+size_t list_dir_changes(void);
+
+// apply queued changes to the listing (once it's completely read), pos is moved
+// along with the entry it points to, returns the number of entries shown
+size_t list_dir_apply_changes(size_t* pos);
+
+// read the directory again and report names added or removed since it was listed
+// (for changes that come without events), returns false if it couldn't be read
+bool list_dir_rescan(void (*on_change)(const char*, bool));
+
+// stat entries through io_uring when it's available
+void list_dir_use_uring(bool enable);
+
+// check if entries are stat'ed through io_uring
+bool list_dir_uses_uring(void);
+
+// show or hide entries whose name starts with a dot (without reading the directory
+// again), pos is moved to the entry it points to or the next one shown, returns
+// the number of entries shown
+size_t list_dir_show_hidden(bool show, size_t* pos);
+
+// check if hidden entries are shown
+bool list_dir_shows_hidden(void);
+
+// check if io_uring (with statx support) is available
+bool uring_available(void);
+
+// stat n names relative to dir_fd in one batch, returns -1 if io_uring is not available
+struct statx;
+int uring_statx(int dir_fd, size_t n, const char* const names[n], const int flags[n],
+                unsigned int mask, struct statx* bufs, int res[n]);
+
+// time listing, sorting and guessing the file types of a directory (printing the times), returns the exit status
+int benchmark(const char* path);
+
+// check if sort order needs metadata
+bool sort_needs_info(char order);
+
+// sort directory (orders that need metadata fall back to names until it's loaded)
 void sort_dir(char order);
 
+// get the order entries are actually sorted in
+char sort_dir_order(void);
+
+// get the kind of collation keys an order sorts by (0 if it sorts by entries themselves)
+char sort_key_kind(char order);
+
+// write the collation key of name (as much as fits in size bytes, like strxfrm), returns its length
+size_t sort_collation_key(size_t size, char key[size], const char* name, char kind);
+
+// sort n entry indices in an ascending order (huge directories are sorted on several
+// threads, collated has the collation keys of entries for orders that use them),
+// returns false if there's no memory for it
+bool sort_index(uint32_t* idx, size_t n, const Entry* entries, const char* const* collated, char order);
+
+// merge the sorted runs [0, n) and [n, n+run) of idx in an ascending order (buf takes n indices)
+void sort_index_merge(uint32_t* idx, size_t n, size_t run, const Entry* entries, const char* const* collated,
+                      char order, uint32_t* buf);
+
+// free sort buffers
+void sort_free(void);
+
+// start filtering the first n entries (returns false if there's no memory for it)
+bool filter_begin(size_t n);
+
+// start filtering n names instead (they must stay there until filter_end)
+bool filter_begin_names(size_t n, const char* const* names);
+
+// filter entries by query (case insensitive fuzzy match), returns the number of matches
+size_t filter_update(const char* query);
+
+// get the positions of the matching entries (best match first)
+const uint32_t* filter_matches(void);
+
+// stop filtering (and free its buffers)
+void filter_end(void);
+
+// start finding files under root on background threads (hidden ones too if hidden),
+// returns false if root cannot be read
+bool finder_start(const char* root, bool hidden);
+
+// find the files under root that match a metadata query instead (it must stay
+// there until finder_stop)
+bool finder_start_query(const char* root, bool hidden, const Query* query);
+
+// check if the background threads are still walking the tree
+bool finder_walking(void);
+
+// get the number of paths found so far
+size_t finder_found(void);
+
+// get the path found i-th (relative to the root)
+const char* finder_path(size_t i);
+
+// match the paths found against query (a case insensitive substring of the path)
+void finder_query(const char* query);
+
+// match the paths found since the last update, returns true if there are new matches
+bool finder_update(void);
+
+// get the number of matching paths
+size_t finder_matches(void);
+
+// get the i-th matching path (relative to the root)
+const char* finder_match(size_t i);
+
+// stop finding (and free the paths found)
+void finder_stop(void);
+
+// index the paths under root (kept in ~/.cache/raider and updated on a background thread),
+// returns false if root cannot be read
+bool tree_index_add(const char* root);
+
+// use the index that covers dir (if there's one ready) for queries, until index_end
+bool tree_index_begin(const char* dir);
+
+// find the paths under dir matching query (a case insensitive substring), ids
+// is grown as needed, returns their number
+size_t tree_index_query(const char* query, bool hidden, uint32_t** ids, size_t* cap);
+
+// get the path of id (relative to dir)
+const char* tree_index_path(uint32_t id);
+
+// stop using the index
+void tree_index_end(void);
+
+// stop the index threads (and free the indexes)
+void tree_index_free(void);
+
+// record a visit to directory dir (in ~/.cache/raider/frecency)
+void frecency_visit(const char* dir);
+
+// forget directory dir (it's not there anymore)
+void frecency_forget(const char* dir);
+
+// rank the directories visited but current (most frequently and recently visited
+// first) for matching, returns false if there's no database
+bool frecency_begin(const char* current);
+
+// match the directories against query (case insensitive fuzzy match), returns
+// the number of matches
+size_t frecency_query(const char* query);
+
+// get the i-th matching directory (best match first)
+const char* frecency_match(size_t i);
+
+// stop matching directories
+void frecency_end(void);
+
+// close the database
+void frecency_close(void);
+
+// compile a metadata query (space separated terms, all of them must match), NULL
+// if it's not valid (err tells why)
+Query* query_compile(const char* text, char* err, size_t err_len);
+
+// check if an entry of dir_fd matches the query (type is the DT_* the directory
+// gives, depth how many levels below the root it is), only the metadata the
+// query needs is read
+bool query_test(const Query* query, int dir_fd, const char* name, unsigned char type, size_t depth);
+
+// get the deepest level a query can match (SIZE_MAX if any)
+size_t query_depth(const Query* query);
+
+// free a query
+void query_free(Query* query);
+
 // resize window callback
 void action_resize_window(void);
 
@@ -153,6 +454,24 @@ void action_goto_home(void);
 // refresh
 void action_refresh(void);
 
+// read some more of a directory that is being streamed in
+void action_load_more(void);
+
+// load some pending metadata (re-sorting when it's complete)
+void action_load_metadata(void);
+
+// note a change to an entry of the current directory
+void action_entry_changed(const char* name, bool removed);
+
+// apply the changes to the current directory collected over a short window
+void action_apply_changes(void);
+
+// read the highlighted directory and the parent ahead of time (a chunk at a time)
+void action_prefetch(void);
+
+// show or hide hidden files
+void action_toggle_hidden(void);
+
 // move the pointer up by 1
 void action_up(bool update_preview);
 
@@ -183,9 +502,30 @@ void action_reorder(const char order);
 // select item
 void action_select(void);
 
+// select all the entries shown
+void action_select_all(void);
+
+// select the entries shown that are not selected, deselect the others
+void action_select_invert(void);
+
+// select the entries shown of the kind of the pointed one (directories or files of its type)
+void action_select_kind(void);
+
+// open the prompt for a pattern to select entries by (a glob, or a regex after a /)
+void action_select_matching(void);
+
+// check if the pattern prompt is open
+bool action_selecting_matching(void);
+
+// handle a key typed in the pattern prompt
+void action_select_matching_key(int ch);
+
 // show file/directory information
 void action_show_info(void);
 
+// show listing cache counters
+void action_show_cache_info(void);
+
 // drop into a shell in the current directory
 void action_open_shell(void);
 
@@ -195,6 +535,46 @@ void action_open_editor(void);
 // FZF search
 void action_fzf_search(void);
 
+// find files under the current directory (they're listed as they are found)
+void action_find(void);
+
+// check if the found files are shown
+bool action_finding(void);
+
+// handle a key while finding (it edits the query, moves, opens or ends finding)
+void action_find_key(int ch);
+
+// show the files found since the last time
+void action_find_more(void);
+
+// start filtering the current directory as the query is typed
+void action_filter(void);
+
+// check if the current directory is being filtered
+bool action_filtering(void);
+
+// handle a key while filtering (it edits the query, moves or ends filtering)
+void action_filter_key(int ch);
+
+// jump to one of the directories visited (the most frequently and recently visited
+// ones first, matched as the query is typed)
+void action_jump(void);
+
+// check if the jump prompt is shown
+bool action_jumping(void);
+
+// handle a key in the jump prompt (it edits the query, moves, jumps or ends)
+void action_jump_key(int ch);
+
+// open the metadata query prompt (the results are listed like a directory)
+void action_query(void);
+
+// check if the query prompt is open
+bool action_querying(void);
+
+// handle a key typed in the query prompt
+void action_query_key(int ch);
+
 // the main event loop
 void event_loop(void);
 
@@ -203,6 +583,10 @@ void display_update_top(void);
 void display_update_bot(void);
 void display_update_lft(void);
 void display_update_rgt(bool update_preview);
+void display_update_filter(const char* query, size_t matches);
+void display_update_prompt(const char* prompt, const char* text);
+void display_update_found(const char* root, bool walking);
+void display_update_jump(void);
 void display_error(const char* error);
 
 // initialize preview based on available stuff
@@ -239,11 +623,9 @@ extern WINDOW*  WLFT;
 extern WINDOW*  WRGT;
 
 extern State*   STATE;
-extern Entry*   ENTRIES;
 extern Config*  CONFIG;
 extern Preview* PREVIEW;
-extern BTNode*  HISTORY;
-extern BTNode*  SELECTION;
+extern KeyMap*  HISTORY;
 
 extern char     USER[256];
 extern char     HOST[256];
@@ -38,12 +38,45 @@
 #define PATH_IS_SPECIAL       -5
 #define PATH_IS_EMPTY         -6
 
+// arena block (allocations are carved out of data)
+typedef struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t             size;
+  size_t             used;
+  char               data[];
+} ArenaBlock;
+
+// memory arena: blocks never move (pointers stay valid until reset) and they
+// are kept across resets so that they can be reused
+typedef struct {
+  ArenaBlock* head;
+  ArenaBlock* cur;
+} Arena;
+
 
 // check if string starts with pattern
 bool starts_with(const char* str, const char* pat);
 
-// returns true if pat equals one of the element in the comma separated list strs
-bool is_one_of(const char* pat, const char* strs);
+// FNV-1a hash of len bytes of s
+uint64_t fnv1a(const char* s, size_t len);
+
+// guess file type from extension (without allocating, case insensitive)
+FileType get_file_type(const char* ext);
+
+// allocate size bytes (8 bytes aligned) from arena
+void* arena_alloc(Arena* arena, size_t size);
+
+// copy string into arena
+char* arena_strdup(Arena* arena, const char* str, size_t len);
+
+// release all allocations (keeping the blocks)
+void arena_reset(Arena* arena);
+
+// free arena blocks
+void arena_free(Arena* arena);
+
+// total size of arena blocks
+size_t arena_size(const Arena* arena);
 
 // read whole line
 char* fgetline(size_t size, char s[restrict size], FILE*restrict stream);
@@ -57,12 +90,16 @@ int path_get_full(char* path, const Entry* file_entry, bool escape);
 // get mime type
 void get_mime_type(size_t mimesz, char mime[mimesz], const Entry* file_entry);
 
-// get file extension
-void path_get_extension(size_t extsz, char ext[extsz], const char* file_name);
+// get offset of file extension in file name (the name length if there's none)
+size_t path_get_extension(const char* file_name, size_t len);
 
 // check if path exists
 bool path_exists(const char* path);
 
+// get the path of the cache directory (~/.cache/raider), creating it if it isn't there,
+// false if there's no home
+bool cache_dir(size_t size, char path[size]);
+
 // escape single quotes (for shell command arguments)
 void escape_quote(size_t escsz, char esc[escsz], const char* buf);
 
@@ -78,10 +115,37 @@ void get_time_line(size_t timesz, char time[timesz], const time_t t);
 // update window titlebar
 void update_titlebar(void);
 
-// save selected files
+// select a file (path is where it is), returns false if there's no memory for it
+bool selection_add(uint64_t dev, uint64_t ino, const char* path);
+
+// deselect a file
+void selection_remove(uint64_t dev, uint64_t ino);
+
+// get a cleared bitset of n bits (it's reused, freed with the selection)
+uint64_t* selection_marks(size_t n);
+
+// make the selection of the first n entries shown (listed from dir) what bits
+// says (a bit per entry), returns how many files were selected or deselected
+size_t selection_merge(const char* dir, size_t n, const uint64_t* bits);
+
+// check if a file is selected
+bool selection_has(uint64_t dev, uint64_t ino);
+
+// number of selected files
+size_t selection_size(void);
+
+// deselect all files
+void selection_clear(void);
+
+// free selection buffers
+void selection_free(void);
+
+// save selected files (appending those selected since the last save, the file is
+// written anew if some were deselected)
 void selection_save(void);
 
-// remove non-existing files from selection
+// remove non-existing files from selection (checked a directory at a time), saving it if
+// some were removed
 void selection_purge(void);
 
 // clear selection file
@@ -90,8 +154,9 @@ void selection_remove_file(void);
 // subscribe to kernel events
 void events_subscribe(const char* dir);
 
-// consume kernel events
-void events_consume(void (*on_dir_change)(void), void (*on_dir_unavailable)(void));
+// consume kernel events (entry changes are reported by name where possible)
+void events_consume(void (*on_dir_change)(void), void (*on_entry_change)(const char*, bool),
+                    void (*on_dir_unavailable)(void));
 
 // unsubscribe from kernel events
 void events_unsubscribe(void);
@@ -24,17 +24,56 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#include "btree.h"
+#include "keymap.h"
 #include "raider.h"
 #include "utils.h"
 
 #include <dirent.h>
+#include <fnmatch.h>
+#include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+// number of entries whose metadata is loaded per event loop iteration
+#define LOAD_CHUNK 4096
+
+// number of names read per event loop iteration (when streaming a directory)
+#define READ_CHUNK 16384
+
+// file to point to once it has been streamed in
+static char GOTO_PENDING[NAME_MAX+1] = "";
+
+// changes to the current directory are collected for this long before they're applied
+#define CHANGES_WINDOW_MS 50
+
+// when the first of the collected changes came in
+static struct timespec CHANGES_SINCE;
+
+// a line typed in a prompt (the prompts listing something else put the state of the
+// directory aside meanwhile, what they list has its own)
+typedef struct {
+  bool   open;
+  char   text[FILTER_QUERY_MAX+1];
+  State* saved;                       // the state of the directory (NULL if not put aside)
+  State  state;
+} Prompt;
+
+// what a key typed in a prompt did to it
+typedef enum { prompt_none, prompt_edited, prompt_resized, prompt_accepted, prompt_cancelled } PromptKey;
+
+// metadata query results are listed like a directory (with a state of their own),
+// the query is typed in a prompt first
+static Prompt QUERY_PROMPT;
+static char QUERY_LABEL[FILTER_QUERY_MAX+8] = "";
+static Query* QUERY_COMPILED = NULL;
+static State QUERY_STATE;
+static size_t QUERY_READ = 0;        // paths found given to the listing
+static bool QUERY_HALT = false;      // no more paths are waited for
+
 
 static
 State* fix_directory_state(char* directory, State dflt) {
@@ -43,7 +82,7 @@ State* fix_directory_state(char* directory, State dflt) {
 
   // get directory inode
   if (stat(directory, &dir_info) == 0) {
-    tmp = (State*) btree_get(HISTORY, btree_cantor(dir_info.st_dev, dir_info.st_ino));
+    tmp = (State*) keymap_get(HISTORY, keymap_key(dir_info.st_dev, dir_info.st_ino));
 
     if (tmp == NULL) {
       tmp = (State*) malloc(sizeof(State));
@@ -55,7 +94,7 @@ State* fix_directory_state(char* directory, State dflt) {
       tmp->order     = dflt.order;
       tmp->files_n   = dflt.files_n;
 
-      btree_set(HISTORY, btree_cantor(dir_info.st_dev, dir_info.st_ino), (void*)tmp);
+      keymap_set(HISTORY, keymap_key(dir_info.st_dev, dir_info.st_ino), (void*)tmp);
     }
     else if (tmp->files_n != dflt.files_n) {
       // file number has changed: it's necessary to fix the state
@@ -120,6 +159,26 @@ void move_pos_to(size_t new_pos) {
 }
 
 
+static
+void sort_keep_current(char order) {
+  char current_file_name[PATH_MAX];
+
+  // hidden entries are still sorted when none is shown
+  if (STATE->files_n == 0) {
+    sort_dir(order);
+    return;
+  }
+
+  strlcpy(current_file_name, entry_at(STATE->pos)->name, sizeof(current_file_name));
+
+  sort_dir(order);
+
+  size_t pos = list_dir_find(current_file_name, STATE->files_n);
+
+  if (pos < STATE->files_n) move_pos_to(pos);
+}
+
+
 static
 void suspend_exec_resume(const char* dir, const char* cmd, const char* err) {
   endwin();
@@ -137,12 +196,19 @@ void suspend_exec_resume(const char* dir, const char* cmd, const char* err) {
 }
 
 
-void action_resize_window(void) {
+// make the windows again for the new size of the terminal
+static
+void resize_terminal(void) {
   endwin();
 
   init_curses();
 
   preview_get_xwin_size(PREVIEW);
+}
+
+
+void action_resize_window(void) {
+  resize_terminal();
 
   display_update_top();
   display_update_bot();
@@ -151,9 +217,208 @@ void action_resize_window(void) {
 }
 
 
+// open a prompt (with the state of the directory put aside if put_aside)
+static
+void prompt_open(Prompt* prompt, bool put_aside) {
+  // escape is the way out of a prompt: don't wait for a sequence after it
+  set_escdelay(25);
+
+  prompt->open = true;
+
+  if (put_aside) {
+    prompt->saved = STATE;
+    prompt->state = *STATE;
+    STATE = &prompt->state;
+  }
+}
+
+
+// close a prompt (back to the state of the directory if it was put aside)
+static
+void prompt_close(Prompt* prompt) {
+  prompt->open = false;
+
+  if (prompt->saved != NULL) {
+    STATE = prompt->saved;
+    prompt->saved = NULL;
+  }
+}
+
+
+// edit the line of a prompt with the key typed, keys it has nothing to do with are left
+// to the caller (as is redrawing, after a resize only the top line is there)
+static
+PromptKey prompt_key(Prompt* prompt, int ch) {
+  size_t len = strlen(prompt->text);
+
+  if (ch == 27)
+    return prompt_cancelled;
+
+  if (ch == '\n' || ch == '\r' || ch == KEY_ENTER)
+    return prompt_accepted;
+
+  if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
+    if (len == 0) return prompt_none;
+
+    prompt->text[len-1] = '\0';
+    return prompt_edited;
+  }
+
+  if (ch == KEY_RESIZE) {
+    // (the directory is redrawn unless something else is listed)
+    if (prompt->saved == NULL) action_resize_window();
+    else {
+      resize_terminal();
+      display_update_top();
+    }
+
+    return prompt_resized;
+  }
+
+  if (ch >= ' ' && ch < 127 && len < FILTER_QUERY_MAX) {
+    prompt->text[len] = (char) ch;
+    prompt->text[len+1] = '\0';
+    return prompt_edited;
+  }
+
+  return prompt_none;
+}
+
+
+// stop walking for the query
+static
+void query_stop(void) {
+  if (QUERY_COMPILED == NULL) return;
+
+  finder_stop();
+  query_free(QUERY_COMPILED);
+
+  QUERY_COMPILED = NULL;
+}
+
+
+// the finder is needed for something else: list what the query found so far
+static
+void query_halt(void) {
+  if (QUERY_COMPILED == NULL) return;
+
+  QUERY_HALT = true;
+
+  while (list_dir_label() != NULL && list_dir_reading()) action_load_more();
+
+  query_stop();
+}
+
+
+// gives the listing the paths found as they come
+static
+int query_source(const char** name, unsigned char* type) {
+  if (QUERY_COMPILED == NULL) return -1;
+
+  // (paths found just before the walk ends are looked at after it)
+  bool walking = !QUERY_HALT && finder_walking();
+
+  if (QUERY_READ < finder_found()) {
+    *name = finder_path(QUERY_READ++);
+    *type = DT_UNKNOWN;
+    return 1;
+  }
+
+  if (walking) return 0;
+
+  // the listing has its own copy of the paths
+  query_stop();
+
+  return -1;
+}
+
+
+// list the results of the query typed (the prompt stays if it's not valid)
+static
+void query_start(void) {
+  char err[FILTER_QUERY_MAX+32];
+  Query* query = query_compile(QUERY_PROMPT.text, err, sizeof(err));
+
+  if (query == NULL) {
+    display_error(err);
+    return;
+  }
+
+  prompt_close(&QUERY_PROMPT);
+
+  query_stop();
+
+  if (!finder_start_query(CURRENT_DIR, list_dir_shows_hidden(), query)) {
+    query_free(query);
+    display_update_top();
+    display_error("cannot find here");
+    return;
+  }
+
+  QUERY_COMPILED = query;
+  QUERY_READ = 0;
+  QUERY_HALT = false;
+
+  snprintf(QUERY_LABEL, sizeof(QUERY_LABEL), "[? %s]", QUERY_PROMPT.text);
+
+  events_unsubscribe();
+
+  GOTO_PENDING[0] = '\0';
+
+  // the directory has no listing anymore
+  int N = list_dir_virtual(CURRENT_DIR, query_source, QUERY_LABEL);
+
+  if (N < 0) {
+    query_stop();
+    action_goto(CURRENT_DIR, "");
+    display_error("cannot find here");
+    return;
+  }
+
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  QUERY_STATE = (State) {
+    .pos       = 0,
+    .start_pos = 0,
+    .end_pos   = N > l ? l-1 : (N > 0 ? N-1 : 0),
+    .files_n   = N,
+    .order     = STATE->order
+  };
+
+  STATE = &QUERY_STATE;
+
+  sort_dir(STATE->order);
+
+  display_update_top();
+
+  werase(WRGT);
+  wrefresh(WRGT);
+
+  if (N == 0) {
+    werase(WLFT);
+    waddstr(WLFT, list_dir_reading() ? "  [Finding]" : "  [No Match]");
+    wrefresh(WLFT);
+
+    werase(WBOT);
+    wrefresh(WBOT);
+
+    return;
+  }
+
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+}
+
+
 void action_goto(const char* dir_part, const char* file_part) {
+  query_stop();
+
   events_unsubscribe();
 
+  GOTO_PENDING[0] = '\0';
+
   int N = list_dir(dir_part);
 
   if (N < 0) {
@@ -172,6 +437,8 @@ void action_goto(const char* dir_part, const char* file_part) {
     wrefresh(WBOT);
   }
   else if (N == 0) {
+    if (strcmp(CURRENT_DIR, dir_part) != 0) frecency_visit(dir_part);
+
     strlcpy(CURRENT_DIR, dir_part, sizeof(CURRENT_DIR));
 
     State dflt = {
@@ -201,6 +468,8 @@ void action_goto(const char* dir_part, const char* file_part) {
     update_titlebar();
   }
   else if (N > 0) {
+    if (strcmp(CURRENT_DIR, dir_part) != 0) frecency_visit(dir_part);
+
     strlcpy(CURRENT_DIR, dir_part, sizeof(CURRENT_DIR));
 
     int l, c __attribute__((unused));
@@ -220,11 +489,13 @@ void action_goto(const char* dir_part, const char* file_part) {
 
     if (file_part[0] != '\0') {
       // goto file
-      for (size_t i = 0; i < STATE->files_n; i++)
-        if (strcmp(file_part, ENTRIES[i].name) == 0) {
-          move_pos_to(i);
-          break;
-        }
+      size_t pos = list_dir_find(file_part, STATE->files_n);
+
+      if (pos < STATE->files_n) move_pos_to(pos);
+
+      // it may be in the part that is still to be read
+      else if (list_dir_reading())
+        strlcpy(GOTO_PENDING, file_part, sizeof(GOTO_PENDING));
     }
 
     events_subscribe(CURRENT_DIR);
@@ -273,11 +544,201 @@ void action_goto_home(void) {
 
 
 void action_refresh(void) {
-  action_goto(CURRENT_DIR, ENTRIES[STATE->pos].name);
+  // (query results are found again)
+  if (list_dir_label() != NULL) {
+    query_start();
+    return;
+  }
+
+  action_goto(CURRENT_DIR, STATE->files_n > 0 ? entry_at(STATE->pos)->name : "");
+}
+
+
+// the entries shown changed: pos is where the pointed entry is now (it's kept at
+// the same line if possible)
+static
+void update_entries(size_t n, size_t pos) {
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  size_t line = STATE->pos - STATE->start_pos;
+
+  STATE->pos = pos;
+  STATE->files_n = n;
+  STATE->start_pos = pos > line ? pos - line : 0;
+  STATE->end_pos = STATE->start_pos + l - 1 < n ? STATE->start_pos + l - 1 : n - 1;
+
+  // no empty rows at the bottom if there's more above
+  if (STATE->end_pos - STATE->start_pos + 1 < (size_t) l)
+    STATE->start_pos = STATE->end_pos + 1 > (size_t) l ? STATE->end_pos + 1 - l : 0;
+
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+}
+
+
+void action_load_more(void) {
+  // (query results may have nothing to show yet)
+  if (STATE == NULL || (STATE->files_n == 0 && list_dir_label() == NULL) || !list_dir_reading()) return;
+
+  size_t pos = STATE->pos;
+  size_t n = list_dir_read_more(READ_CHUNK, &pos);
+
+  if (n == 0) {
+    werase(WLFT);
+    waddstr(WLFT, list_dir_reading() ? "  [Finding]" : "  [No Match]");
+    wrefresh(WLFT);
+    return;
+  }
+
+  if (STATE->files_n == 0) {
+    update_entries(n, 0);
+    return;
+  }
+
+  if (n != STATE->files_n) {
+    // keep the cursor on the same entry, at the same line
+    int l, c __attribute__((unused));
+    getmaxyx(WLFT, l, c);
+
+    STATE->start_pos += pos - STATE->pos;
+    STATE->pos = pos;
+    STATE->files_n = n;
+    STATE->end_pos = STATE->start_pos + l - 1 < n ? STATE->start_pos + l - 1 : n - 1;
+
+    if (GOTO_PENDING[0] != '\0') {
+      size_t found = list_dir_find(GOTO_PENDING, STATE->files_n);
+
+      if (found < STATE->files_n) {
+        move_pos_to(found);
+        GOTO_PENDING[0] = '\0';
+      }
+    }
+
+    display_update_lft();
+  }
+
+  if (!list_dir_reading()) GOTO_PENDING[0] = '\0';
+
+  display_update_bot();
+}
+
+
+void action_load_metadata(void) {
+  if (STATE == NULL) return;
+
+  // (entries may be pending while none is shown: they may all be hidden)
+  if (list_dir_pending() > 0) {
+    if (list_dir_load_pending(LOAD_CHUNK) > 0) return;
+
+    if (STATE->files_n > 0) display_update_bot();
+  }
+
+  // all metadata is there: apply the order that was waiting for it
+  if (STATE->files_n > 0 && !list_dir_reading() && sort_dir_order() != STATE->order) {
+    sort_keep_current(STATE->order);
+
+    display_update_lft();
+    display_update_bot();
+  }
+}
+
+
+void action_entry_changed(const char* name, bool removed) {
+  if (list_dir_changes() == 0) clock_gettime(CLOCK_MONOTONIC, &CHANGES_SINCE);
+
+  list_dir_change(name, removed);
+}
+
+
+void action_apply_changes(void) {
+  if (STATE == NULL || list_dir_changes() == 0 || list_dir_reading()) return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if ((now.tv_sec - CHANGES_SINCE.tv_sec)*1000 + (now.tv_nsec - CHANGES_SINCE.tv_nsec)/1000000 < CHANGES_WINDOW_MS)
+    return;
+
+  size_t pos = STATE->pos;
+  size_t n = list_dir_apply_changes(&pos);
+
+  // the empty directory view is drawn by action_goto
+  if (n == 0 || STATE->files_n == 0) {
+    action_goto(CURRENT_DIR, n > 0 ? entry_at(0)->name : "");
+    return;
+  }
+
+  update_entries(n, pos);
+}
+
+
+void action_prefetch(void) {
+  // only when there's nothing else to do
+  if (STATE == NULL || list_dir_reading() || list_dir_pending() > 0 || list_dir_changes() > 0) return;
+
+  char path[PATH_MAX];
+  bool reading = false;
+
+  // the highlighted directory first, then the parent (a directory that is no
+  // longer either of them is dropped)
+  if (STATE->files_n > 0) {
+    const Entry* current = entry_at(STATE->pos);
+
+    if (current->loaded && S_ISDIR(current->info.mode) && path_get_full(path, current, false) == 0)
+      reading = list_prefetch(path);
+  }
+
+  if (!reading && CURRENT_DIR[1] != '\0') {
+    strlcpy(path, CURRENT_DIR, sizeof(path));
+
+    char* slash = strrchr(path, '/');
+
+    if (slash != NULL) {
+      slash[slash == path ? 1 : 0] = '\0';
+      reading = list_prefetch(path);
+    }
+  }
+
+  if (reading) list_prefetch_step(READ_CHUNK);
+  else list_prefetch_cancel();
+}
+
+
+void action_toggle_hidden(void) {
+  if (STATE == NULL) return;
+
+  size_t pos = STATE->pos;
+  size_t n = list_dir_show_hidden(!list_dir_shows_hidden(), &pos);
+
+  if (n == 0) {
+    STATE->pos = STATE->start_pos = STATE->end_pos = 0;
+    STATE->files_n = 0;
+
+    werase(WLFT);
+    waddstr(WLFT, "  [Empty]");
+    wrefresh(WLFT);
+
+    werase(WRGT);
+    wrefresh(WRGT);
+
+    werase(WBOT);
+    wrefresh(WBOT);
+
+    return;
+  }
+
+  // coming from an empty view: start from the top
+  if (STATE->files_n == 0) STATE->pos = STATE->start_pos = 0;
+
+  update_entries(n, pos);
 }
 
 
 void action_up(bool update_preview) {
+  if (STATE->files_n == 0) return;
+
   if (STATE->pos == 0) return;
 
   if (STATE->start_pos > 0 && STATE->pos <= STATE->start_pos+4) {
@@ -293,6 +754,8 @@ void action_up(bool update_preview) {
 
 
 void action_down(bool update_preview) {
+  if (STATE->files_n == 0) return;
+
   if (STATE->pos == STATE->files_n-1) return;
 
   if (STATE->end_pos < STATE->files_n-1 && STATE->pos >= STATE->end_pos-4) {
@@ -308,6 +771,8 @@ void action_down(bool update_preview) {
 
 
 void action_page_up(bool update_preview) {
+  if (STATE->files_n == 0) return;
+
   int l, c __attribute__((unused));
 
   getmaxyx(WLFT, l, c);
@@ -320,6 +785,8 @@ void action_page_up(bool update_preview) {
 
 
 void action_page_down(bool update_preview) {
+  if (STATE->files_n == 0) return;
+
   int l, c __attribute__((unused));
 
   getmaxyx(WLFT, l, c);
@@ -332,6 +799,8 @@ void action_page_down(bool update_preview) {
 
 
 void action_home(void) {
+  if (STATE->files_n == 0) return;
+
   move_pos_to(0);
 
   display_update_lft();
@@ -341,6 +810,8 @@ void action_home(void) {
 
 
 void action_end(void) {
+  if (STATE->files_n == 0) return;
+
   move_pos_to(STATE->files_n-1);
 
   display_update_lft();
@@ -350,10 +821,12 @@ void action_end(void) {
 
 
 void action_forward(void) {
-  const Entry* current = &ENTRIES[STATE->pos];
+  if (STATE->files_n == 0) return;
+
+  const Entry* current = entry_at(STATE->pos);
   char path[PATH_MAX];
 
-  if (S_ISDIR(current->info.st_mode)) {
+  if (S_ISDIR(current->info.mode)) {
     // change directory
     if (strlen(CURRENT_DIR) == 1)
       snprintf(path, sizeof(path), "%s%s", CURRENT_DIR, current->name);
@@ -362,7 +835,7 @@ void action_forward(void) {
 
     action_goto_path(path);
   }
-  else if (S_ISREG(current->info.st_mode) && current->info.st_mode & S_IRUSR) {
+  else if (S_ISREG(current->info.mode) && current->info.mode & S_IRUSR) {
     // open file
     int res = path_get_full(path, current, true);
 
@@ -377,6 +850,12 @@ void action_forward(void) {
 
 
 void action_backward(void) {
+  // out of query results
+  if (list_dir_label() != NULL) {
+    action_goto(CURRENT_DIR, "");
+    return;
+  }
+
   char path[PATH_MAX];
   char* rest;
   strlcpy(path, CURRENT_DIR, sizeof(path));
@@ -393,21 +872,13 @@ void action_backward(void) {
 
 
 void action_reorder(const char order) {
-  char current_file_name[NAME_MAX+1];
-
   if (order == STATE->order) return;
 
-  strlcpy(current_file_name, ENTRIES[STATE->pos].name, sizeof(current_file_name));
-
-  sort_dir(order);
+  sort_keep_current(order);
 
   STATE->order = order;
 
-  for (size_t i = 0; i < STATE->files_n; i++)
-    if (strcmp(current_file_name, ENTRIES[i].name) == 0) {
-      move_pos_to(i);
-      break;
-    }
+  if (STATE->files_n == 0) return;
 
   display_update_lft();
   display_update_bot();
@@ -418,36 +889,176 @@ void action_reorder(const char order) {
 void action_select(void){
   if (STATE->files_n == 0) return;
 
-  const Entry* current = &ENTRIES[STATE->pos];
-  BTKey k = btree_cantor(current->info.st_dev, current->info.st_ino);
-
-  if (!btree_has_key(SELECTION, k)) {
+  const Entry* current = entry_at(STATE->pos);
+  if (!selection_has(current->info.dev, current->info.ino)) {
     // select
-    char* path = (char*) malloc(sizeof(char)*(PATH_MAX));
-    int res = path_get_full(path, current, false);
+    char path[PATH_MAX];
 
-    if (res == 0)
-      btree_set(SELECTION, k, path);
-    else
-      free(path);
+    if (path_get_full(path, current, false) == 0 && !selection_add(current->info.dev, current->info.ino, path))
+      display_error("cannot select");
   }
-  else {
+  else
     // deselect
-    char* path = (char*) btree_get(SELECTION, k);
-    btree_set(SELECTION, k, NULL);
-    free(path);
-  }
+    selection_remove(current->info.dev, current->info.ino);
 
   action_down(true);
   display_update_lft();
 }
 
 
+// bulk selection: entries to select are marked, the others are deselected
+typedef enum { mark_all, mark_invert, mark_kind, mark_pattern } MarkBy;
+
+// the pattern to select by (a regex if typed after a /, a glob otherwise)
+static Prompt MATCH_PROMPT;
+static regex_t MATCH_REGEX;
+
+
+static
+bool marked(MarkBy by, const Entry* entry, const Entry* current) {
+  // (entries of query results are matched by file name)
+  const char* name = strrchr(entry->name, '/');
+  name = name != NULL ? name + 1 : entry->name;
+
+  switch (by) {
+  case mark_all:
+    return true;
+
+  case mark_invert:
+    return !selection_has(entry->info.dev, entry->info.ino);
+
+  case mark_kind:
+    if (S_ISDIR(current->info.mode)) return S_ISDIR(entry->info.mode);
+    return !S_ISDIR(entry->info.mode) && entry->type == current->type;
+
+  case mark_pattern:
+    return MATCH_PROMPT.text[0] == '/' ? regexec(&MATCH_REGEX, name, 0, NULL, 0) == 0 : fnmatch(MATCH_PROMPT.text, name, 0) == 0;
+  }
+
+  return false;
+}
+
+
+// select the entries shown in one batch (and redraw once)
+static
+void select_marked(MarkBy by) {
+  if (STATE->files_n == 0) return;
+
+  size_t n = STATE->files_n;
+
+  // (it's by device and inode)
+  list_dir_load(0, n);
+
+  uint64_t* marks = selection_marks(n);
+
+  if (marks == NULL) {
+    display_error("cannot select");
+    return;
+  }
+
+  const Entry* current = entry_at(STATE->pos);
+
+  // (other than inverting, what's selected stays selected)
+  for (size_t pos = 0; pos < n; pos++) {
+    const Entry* entry = entry_at(pos);
+
+    if (marked(by, entry, current) || (by != mark_invert && selection_has(entry->info.dev, entry->info.ino)))
+      marks[pos/64] |= UINT64_C(1) << (pos%64);
+  }
+
+  selection_merge(CURRENT_DIR, n, marks);
+
+  display_update_lft();
+  display_update_bot();
+}
+
+
+void action_select_all(void) {
+  select_marked(mark_all);
+}
+
+
+void action_select_invert(void) {
+  select_marked(mark_invert);
+}
+
+
+void action_select_kind(void) {
+  select_marked(mark_kind);
+}
+
+
+void action_select_matching(void) {
+  if (STATE == NULL || STATE->files_n == 0 || MATCH_PROMPT.open) return;
+
+  prompt_open(&MATCH_PROMPT, false);
+
+  display_update_prompt("select", MATCH_PROMPT.text);
+}
+
+
+bool action_selecting_matching(void) {
+  return MATCH_PROMPT.open;
+}
+
+
+void action_select_matching_key(int ch) {
+  const char* text = MATCH_PROMPT.text;
+
+  switch (prompt_key(&MATCH_PROMPT, ch)) {
+  case prompt_cancelled:
+    prompt_close(&MATCH_PROMPT);
+    display_update_top();
+    break;
+
+  case prompt_accepted:
+    if (text[0] == '\0' || (text[0] == '/' && regcomp(&MATCH_REGEX, text + 1, REG_EXTENDED | REG_NOSUB) != 0)) {
+      display_error("invalid pattern");
+      break;
+    }
+
+    prompt_close(&MATCH_PROMPT);
+    display_update_top();
+
+    select_marked(mark_pattern);
+
+    if (text[0] == '/') regfree(&MATCH_REGEX);
+    break;
+
+  case prompt_edited:
+  case prompt_resized:
+    display_update_prompt("select", text);
+    break;
+
+  case prompt_none:
+    break;
+  }
+}
+
+
 void action_show_info(void) {
   if (STATE->files_n == 0) return;
 
   preview_clear(PREVIEW, WRGT);
-  preview_file_info(WRGT, &ENTRIES[STATE->pos]);
+  preview_file_info(WRGT, entry_at(STATE->pos));
+  wrefresh(WRGT);
+}
+
+
+void action_show_cache_info(void) {
+  ListCacheStats stats;
+  list_cache_stats(&stats);
+
+  preview_clear(PREVIEW, WRGT);
+
+  mvwprintw(WRGT, 0, 1, "      Cache: %zu listings", stats.listings);
+  mvwprintw(WRGT, 2, 1, "     Memory: %zu/%zu KB", stats.bytes/1024, stats.max_bytes/1024);
+  mvwprintw(WRGT, 3, 1, "       Hits: %zu", stats.hits);
+  mvwprintw(WRGT, 4, 1, "     Misses: %zu", stats.misses);
+  mvwprintw(WRGT, 5, 1, "Invalidated: %zu", stats.invalidated);
+  mvwprintw(WRGT, 6, 1, "    Evicted: %zu", stats.evicted);
+  mvwprintw(WRGT, 7, 1, " Prefetched: %zu", stats.prefetched);
+
   wrefresh(WRGT);
 }
 
@@ -465,21 +1076,21 @@ void action_open_shell(void) {
 
 
 void action_open_editor(void) {
-  if (!CONFIG->has_emacsclient && !CONFIG->has_vim) return;
+  if (STATE->files_n == 0 || (!CONFIG->has_emacsclient && !CONFIG->has_vim)) return;
 
-  const Entry* current = &ENTRIES[STATE->pos];
+  const Entry* current = entry_at(STATE->pos);
 
-  if (S_ISDIR(current->info.st_mode)) {
+  if (S_ISDIR(current->info.mode)) {
     if (CONFIG->has_emacsclient)
       suspend_exec_resume(CURRENT_DIR, "emacsclient -nw .", "cannot open editor here");
     else if (CONFIG->has_vim)
       suspend_exec_resume(CURRENT_DIR, "vim .", "cannot open editor here");
   }
-  else if (S_ISREG(current->info.st_mode) && current->info.st_mode & S_IRUSR && current->type == text) {
-    char path[NAME_MAX+1];
+  else if (S_ISREG(current->info.mode) && current->info.mode & S_IRUSR && (current->type == text || current->type == code)) {
+    char path[PATH_MAX];
     escape_quote(sizeof(path), path, current->name);
 
-    char cmd[NAME_MAX+32] = "";
+    char cmd[PATH_MAX+32] = "";
 
     if (CONFIG->has_emacsclient)
       snprintf(cmd, sizeof(cmd), "emacsclient -nw '%s'", path);
@@ -524,3 +1135,396 @@ void action_fzf_search(void) {
   }
   else init_curses();
 }
+
+
+// the query for the paths found (and where they were looked for)
+static Prompt FIND_PROMPT;
+static char FIND_ROOT[PATH_MAX] = "";
+
+
+// show the paths found matching the query (from the top unless keep_pos)
+static
+void find_show(bool keep_pos) {
+  size_t n = finder_matches();
+
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  if (!keep_pos || STATE->pos >= n) STATE->pos = STATE->start_pos = 0;
+
+  STATE->files_n = n;
+  STATE->end_pos = STATE->start_pos + l - 1 < n ? STATE->start_pos + l - 1 : (n > 0 ? n - 1 : 0);
+
+  display_update_filter(FIND_PROMPT.text, n);
+  display_update_found(FIND_ROOT, finder_walking());
+}
+
+
+// stop finding, going to the path pointed in the results (if keep)
+static
+void find_stop(bool keep) {
+  char path[PATH_MAX] = "";
+
+#pragma GCC diagnostic push
+#ifndef __clang__
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#endif
+  if (keep && STATE->files_n > 0)
+    snprintf(path, sizeof(path), "%s/%s", strlen(FIND_ROOT) > 1 ? FIND_ROOT : "", finder_match(STATE->pos));
+#pragma GCC diagnostic pop
+
+  finder_stop();
+
+  prompt_close(&FIND_PROMPT);
+
+  werase(WRGT);
+  wrefresh(WRGT);
+
+  werase(WBOT);
+  wrefresh(WBOT);
+
+  if (path[0] != '\0') {
+    action_goto_path(path);
+    return;
+  }
+
+  display_update_top();
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+}
+
+
+void action_find(void) {
+  if (STATE == NULL || FIND_PROMPT.open) return;
+
+  query_halt();
+
+  if (!finder_start(CURRENT_DIR, list_dir_shows_hidden())) {
+    display_error("cannot find here");
+    return;
+  }
+
+  strlcpy(FIND_ROOT, CURRENT_DIR, sizeof(FIND_ROOT));
+
+  prompt_open(&FIND_PROMPT, true);
+
+  FIND_PROMPT.text[0] = '\0';
+  finder_query(FIND_PROMPT.text);
+
+  werase(WRGT);
+  wrefresh(WRGT);
+
+  find_show(false);
+}
+
+
+bool action_finding(void) {
+  return FIND_PROMPT.open;
+}
+
+
+void action_find_more(void) {
+  static bool walking = false;
+
+  // (the last update after the walk is done says so)
+  if (finder_update() || walking != finder_walking()) {
+    walking = finder_walking();
+    find_show(true);
+  }
+}
+
+
+void action_find_key(int ch) {
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  switch (prompt_key(&FIND_PROMPT, ch)) {
+  case prompt_cancelled:
+    find_stop(false);
+    break;
+
+  case prompt_accepted:
+    find_stop(true);
+    break;
+
+  case prompt_edited:
+    finder_query(FIND_PROMPT.text);
+    finder_update();
+    find_show(false);
+    break;
+
+  case prompt_resized:
+    find_show(true);
+    break;
+
+  case prompt_none:
+    if (STATE->files_n == 0 || (ch != KEY_UP && ch != KEY_DOWN && ch != KEY_PPAGE && ch != KEY_NPAGE)) break;
+
+    move_pos_by(ch == KEY_UP ? -1 : ch == KEY_DOWN ? 1 : ch == KEY_PPAGE ? -(l/2) : l/2);
+    find_show(true);
+    break;
+  }
+}
+
+
+// the query the entries are filtered by
+static Prompt FILTER_PROMPT;
+
+
+// show the entries matching the query (from the top unless keep_pos)
+static
+void filter_show(bool keep_pos) {
+  size_t n = filter_update(FILTER_PROMPT.text);
+
+  list_dir_filter(filter_matches());
+
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  if (!keep_pos || STATE->pos >= n) STATE->pos = STATE->start_pos = 0;
+
+  STATE->files_n = n;
+  STATE->end_pos = STATE->start_pos + l - 1 < n ? STATE->start_pos + l - 1 : (n > 0 ? n - 1 : 0);
+
+  display_update_filter(FILTER_PROMPT.text, n);
+
+  if (n == 0) {
+    werase(WLFT);
+    waddstr(WLFT, "  [No Match]");
+    wrefresh(WLFT);
+
+    werase(WRGT);
+    wrefresh(WRGT);
+
+    werase(WBOT);
+    wrefresh(WBOT);
+
+    return;
+  }
+
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+}
+
+
+// stop filtering, pointing to the entry that was pointed in the filter (if keep)
+static
+void filter_stop(bool keep) {
+  const char* name = keep && STATE->files_n > 0 ? entry_at(STATE->pos)->name : NULL;
+
+  list_dir_filter(NULL);
+
+  prompt_close(&FILTER_PROMPT);
+
+  if (name != NULL) move_pos_to(list_dir_find(name, STATE->pos));
+
+  filter_end();
+
+  display_update_top();
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+}
+
+
+void action_filter(void) {
+  if (STATE == NULL || STATE->files_n == 0 || FILTER_PROMPT.open) return;
+
+  if (!filter_begin(STATE->files_n)) {
+    display_error("cannot filter");
+    return;
+  }
+
+  prompt_open(&FILTER_PROMPT, true);
+
+  FILTER_PROMPT.text[0] = '\0';
+
+  filter_show(true);
+}
+
+
+bool action_filtering(void) {
+  return FILTER_PROMPT.open;
+}
+
+
+void action_filter_key(int ch) {
+  switch (prompt_key(&FILTER_PROMPT, ch)) {
+  case prompt_cancelled:
+    filter_stop(false);
+    break;
+
+  case prompt_accepted:
+    filter_stop(true);
+    break;
+
+  case prompt_edited:
+    filter_show(false);
+    break;
+
+  case prompt_resized:
+    filter_show(true);
+    break;
+
+  case prompt_none:
+    if (ch == KEY_UP) action_up(true);
+    else if (ch == KEY_DOWN) action_down(true);
+    else if (ch == KEY_PPAGE) action_page_up(true);
+    else if (ch == KEY_NPAGE) action_page_down(true);
+    break;
+  }
+}
+
+
+// the query for the directories visited
+static Prompt JUMP_PROMPT;
+
+
+// show the directories matching the query (from the top unless keep_pos)
+static
+void jump_show(bool keep_pos) {
+  size_t n = frecency_query(JUMP_PROMPT.text);
+
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  if (!keep_pos || STATE->pos >= n) STATE->pos = STATE->start_pos = 0;
+
+  STATE->files_n = n;
+  STATE->end_pos = STATE->start_pos + l - 1 < n ? STATE->start_pos + l - 1 : (n > 0 ? n - 1 : 0);
+
+  display_update_filter(JUMP_PROMPT.text, n);
+  display_update_jump();
+}
+
+
+// leave the jump prompt, going to the directory pointed (if keep)
+static
+void jump_stop(bool keep) {
+  char path[PATH_MAX] = "";
+
+  if (keep && STATE->files_n > 0) strlcpy(path, frecency_match(STATE->pos), sizeof(path));
+
+  frecency_end();
+
+  prompt_close(&JUMP_PROMPT);
+
+  werase(WRGT);
+  wrefresh(WRGT);
+
+  werase(WBOT);
+  wrefresh(WBOT);
+
+  // (straight there, without listing the directories in between)
+  struct stat info;
+
+  if (path[0] != '\0' && stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+    action_goto(path, "");
+    return;
+  }
+
+  display_update_top();
+  display_update_lft();
+  display_update_bot();
+  display_update_rgt(true);
+
+  // it's not there anymore
+  if (path[0] != '\0') {
+    frecency_forget(path);
+    display_error("directory not found");
+  }
+}
+
+
+void action_jump(void) {
+  if (STATE == NULL || JUMP_PROMPT.open) return;
+
+  if (!frecency_begin(CURRENT_DIR)) {
+    display_error("cannot read visited directories");
+    return;
+  }
+
+  prompt_open(&JUMP_PROMPT, true);
+
+  JUMP_PROMPT.text[0] = '\0';
+
+  werase(WRGT);
+  wrefresh(WRGT);
+
+  jump_show(false);
+}
+
+
+bool action_jumping(void) {
+  return JUMP_PROMPT.open;
+}
+
+
+void action_jump_key(int ch) {
+  int l, c __attribute__((unused));
+  getmaxyx(WLFT, l, c);
+
+  switch (prompt_key(&JUMP_PROMPT, ch)) {
+  case prompt_cancelled:
+    jump_stop(false);
+    break;
+
+  case prompt_accepted:
+    jump_stop(true);
+    break;
+
+  case prompt_edited:
+    jump_show(false);
+    break;
+
+  case prompt_resized:
+    jump_show(true);
+    break;
+
+  case prompt_none:
+    if (STATE->files_n == 0 || (ch != KEY_UP && ch != KEY_DOWN && ch != KEY_PPAGE && ch != KEY_NPAGE)) break;
+
+    move_pos_by(ch == KEY_UP ? -1 : ch == KEY_DOWN ? 1 : ch == KEY_PPAGE ? -(l/2) : l/2);
+    jump_show(true);
+    break;
+  }
+}
+
+
+void action_query(void) {
+  if (STATE == NULL || QUERY_PROMPT.open) return;
+
+  // (the last query is there to be changed)
+  prompt_open(&QUERY_PROMPT, false);
+
+  display_update_prompt("?", QUERY_PROMPT.text);
+}
+
+
+bool action_querying(void) {
+  return QUERY_PROMPT.open;
+}
+
+
+void action_query_key(int ch) {
+  switch (prompt_key(&QUERY_PROMPT, ch)) {
+  case prompt_cancelled:
+    prompt_close(&QUERY_PROMPT);
+    display_update_top();
+    break;
+
+  case prompt_accepted:
+    query_start();
+    break;
+
+  case prompt_edited:
+  case prompt_resized:
+    display_update_prompt("?", QUERY_PROMPT.text);
+    break;
+
+  case prompt_none:
+    break;
+  }
+}
@@ -0,0 +1,267 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "raider.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// sorts are repeated until about this many entries were sorted
+#define BENCH_SORTED (1024 * 1024)
+
+// file types are guessed until about this many names were classified
+#define BENCH_CLASSIFIED (4 * 1024 * 1024)
+
+
+static
+double elapsed_ms(const struct timespec* t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  return (t1.tv_sec - t0->tv_sec)*1e3 + (t1.tv_nsec - t0->tv_nsec)/1e6;
+}
+
+
+// list the directory with both backends, returns the number of entries (-1 if
+// it can't be read)
+static
+int benchmark_listing(const char* path) {
+  struct timespec t0;
+  bool backends[2] = { false, true };
+  int n = -1;
+
+  for (size_t i = 0; i < 2; i++) {
+    list_dir_use_uring(backends[i]);
+
+    if (backends[i] && !list_dir_uses_uring()) {
+      printf("%s: io_uring is not available\n", path);
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    n = list_dir(path);
+
+    size_t pos = 0;
+    while (list_dir_reading()) n = list_dir_read_more(SIZE_MAX, &pos);
+
+    if (n > 0) list_dir_load(0, n);
+
+    if (n < 0) {
+      fprintf(stderr, "cannot read directory %s\n", path);
+      return -1;
+    }
+
+    printf("%s: %i entries listed in %.3f ms (%s)\n", path, n, elapsed_ms(&t0), backends[i] ? "io_uring" : "sync");
+  }
+
+  return n;
+}
+
+
+// the comparators entries were sorted with before sort_index (sizes and times
+// truncated to int, as they were)
+static const Entry* BENCH_ENTRIES = NULL;
+
+static
+int by_name(const void* a, const void* b) {
+  return strcmp(BENCH_ENTRIES[*(const uint32_t*) a].name, BENCH_ENTRIES[*(const uint32_t*) b].name);
+}
+
+
+static
+int by_size(const void* a, const void* b) {
+  int a_size = BENCH_ENTRIES[*(const uint32_t*) a].info.size;
+  int b_size = BENCH_ENTRIES[*(const uint32_t*) b].info.size;
+
+  return a_size - b_size;
+}
+
+
+static
+int by_ctime(const void* a, const void* b) {
+  int a_ctime = BENCH_ENTRIES[*(const uint32_t*) a].info.ctime;
+  int b_ctime = BENCH_ENTRIES[*(const uint32_t*) b].info.ctime;
+
+  return a_ctime - b_ctime;
+}
+
+
+// sort the n entries listed (shuffled) with sort_index and with qsort
+static
+void benchmark_sort(const char* path, size_t n) {
+  Entry* entries = malloc(n*sizeof(Entry));
+  uint32_t* shuffled = malloc(n*sizeof(uint32_t));
+  uint32_t* idx = malloc(n*sizeof(uint32_t));
+
+  if (entries == NULL || shuffled == NULL || idx == NULL) {
+    fprintf(stderr, "no memory to sort %zu entries\n", n);
+    goto done;
+  }
+
+  // (the same shuffle every time, so runs can be compared)
+  uint64_t rnd = 88172645463325252ULL;
+
+  for (size_t i = 0; i < n; i++) {
+    entries[i] = *entry_at(i);
+    shuffled[i] = i;
+  }
+
+  for (size_t i = n; i > 1; i--) {
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 7;
+    rnd ^= rnd << 17;
+
+    size_t j = rnd % i;
+    uint32_t t = shuffled[i-1];
+    shuffled[i-1] = shuffled[j];
+    shuffled[j] = t;
+  }
+
+  BENCH_ENTRIES = entries;
+
+  const struct {
+    char        order;
+    const char* name;
+    int       (*cmp)(const void*, const void*);
+  } orders[] = { { 'n', "name", by_name }, { 'z', "size", by_size }, { 't', "ctime", by_ctime } };
+
+  size_t runs = n < BENCH_SORTED ? BENCH_SORTED/n : 1;
+  struct timespec t0;
+
+  for (size_t o = 0; o < sizeof(orders)/sizeof(orders[0]); o++) {
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t r = 0; r < runs; r++) {
+      memcpy(idx, shuffled, n*sizeof(uint32_t));
+      sort_index(idx, n, entries, NULL, orders[o].order);
+    }
+    double ms = elapsed_ms(&t0)/runs;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t r = 0; r < runs; r++) {
+      memcpy(idx, shuffled, n*sizeof(uint32_t));
+      qsort(idx, n, sizeof(uint32_t), orders[o].cmp);
+    }
+    double qsort_ms = elapsed_ms(&t0)/runs;
+
+    printf("%s: %zu entries sorted by %s in %.3f ms (qsort %.3f ms)\n", path, n, orders[o].name, ms, qsort_ms);
+  }
+
+ done:
+  free(entries);
+  free(shuffled);
+  free(idx);
+}
+
+
+// how file types were guessed before get_file_type
+static
+bool is_one_of(const char* pat, const char* strs) {
+  char* r = strdup(strs);
+  char* s = r;
+  char* t;
+  while ((t = strsep(&r, ","))) {
+    if (strncmp(pat, t, strlen(pat)) == 0) {
+      free(s);
+      return true;
+    }
+  }
+  free(s);
+  return false;
+}
+
+
+static
+FileType is_one_of_type(const char* name) {
+  char ext[16];
+  strlcpy(ext, name, sizeof(ext));
+
+  for (char* c = ext; *c; c++) *c = tolower((unsigned char) *c);
+
+  if (is_one_of(ext, "txt,org"))
+    return text;
+
+  else if (is_one_of(ext, "pdf,djvu"))
+    return document;
+
+  else if (is_one_of(ext, "png,jpg,jpeg"))
+    return image;
+
+  else if (is_one_of(ext, "avi,mkv,mov,mp4,mpg,wmv,mpeg,webm"))
+    return video;
+
+  else if (is_one_of(ext, "tar,tgz,zip,rar"))
+    return archive;
+
+  return unknown;
+}
+
+
+// guess the file types of the n entries listed with get_file_type and with the
+// is_one_of chain
+static
+void benchmark_file_types(const char* path, size_t n) {
+  size_t runs = n < BENCH_CLASSIFIED ? BENCH_CLASSIFIED/n : 1;
+  size_t known = 0, known_before = 0;
+  struct timespec t0;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (size_t r = 0; r < runs; r++) {
+    for (size_t i = 0; i < n; i++) {
+      const Entry* entry = entry_at(i);
+      known += get_file_type(entry_ext(entry)) != unknown;
+    }
+  }
+  double ns = elapsed_ms(&t0)*1e6/(runs*n);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (size_t r = 0; r < runs; r++) {
+    for (size_t i = 0; i < n; i++) {
+      const Entry* entry = entry_at(i);
+      known_before += is_one_of_type(entry_ext(entry)) != unknown;
+    }
+  }
+  double is_one_of_ns = elapsed_ms(&t0)*1e6/(runs*n);
+
+  printf("%s: file types guessed in %.1f ns per name, %zu known (is_one_of %.1f ns, %zu known)\n",
+         path, ns, known/runs, is_one_of_ns, known_before/runs);
+}
+
+
+int benchmark(const char* path) {
+  int n = benchmark_listing(path);
+
+  if (n < 0) return EXIT_FAILURE;
+
+  if (n > 1) benchmark_sort(path, n);
+  if (n > 0) benchmark_file_types(path, n);
+
+  return EXIT_SUCCESS;
+}
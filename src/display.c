@@ -24,7 +24,6 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#include "btree.h"
 #include "raider.h"
 #include "utils.h"
 
@@ -36,19 +35,26 @@
 
 static
 int get_entry_attrs(const Entry* entry) {
-  if (btree_has_key(SELECTION, btree_cantor(entry->info.st_dev, entry->info.st_ino)))
+  if (!entry->loaded) {
+    // metadata still pending: go by what the directory says
+    if (entry->dtype == DT_LNK) return COLOR_PAIR(PAIR_GREEN_BLACK) | A_UNDERLINE;
+    if (entry->dtype == DT_DIR) return COLOR_PAIR(PAIR_BLUE_BLACK);
+    return COLOR_PAIR(PAIR_DEFAULT);
+  }
+
+  if (selection_has(entry->info.dev, entry->info.ino))
     return COLOR_PAIR(PAIR_BLACK_YELLOW | A_BOLD);
 
   if (entry->is_link)
     return COLOR_PAIR(PAIR_GREEN_BLACK) | A_UNDERLINE;
 
-  if (S_ISDIR(entry->info.st_mode))
+  if (S_ISDIR(entry->info.mode))
     return COLOR_PAIR(PAIR_BLUE_BLACK);
 
-  if (S_ISREG(entry->info.st_mode) && entry->info.st_mode & S_IXUSR)
+  if (S_ISREG(entry->info.mode) && entry->info.mode & S_IXUSR)
     return COLOR_PAIR(PAIR_GREEN_BLACK) | A_BOLD;
 
-  if (S_ISREG(entry->info.st_mode)) {
+  if (S_ISREG(entry->info.mode)) {
     switch (entry->type) {
     case file_type_num:
       return COLOR_PAIR(PAIR_DEFAULT);
@@ -59,6 +65,9 @@ int get_entry_attrs(const Entry* entry) {
     case text:
       return COLOR_PAIR(PAIR_DEFAULT);
 
+    case code:
+      return COLOR_PAIR(PAIR_YELLOW_BLACK);
+
     case document:
       return COLOR_PAIR(PAIR_CYAN_BLACK);
 
@@ -68,6 +77,9 @@ int get_entry_attrs(const Entry* entry) {
     case video:
       return COLOR_PAIR(PAIR_MAGENTA_BLACK);
 
+    case audio:
+      return COLOR_PAIR(PAIR_MAGENTA_BLACK);
+
     case archive:
       return COLOR_PAIR(PAIR_RED_BLACK);
     }
@@ -86,6 +98,13 @@ void display_update_top(void) {
   mvwaddstr(WTOP, 0, strlen(USER) + strlen(HOST) + 3, CURRENT_DIR);
   wattroff(WTOP, COLOR_PAIR(PAIR_BLUE_BLACK) | A_BOLD);
 
+  // query results are shown instead of the directory
+  if (list_dir_label() != NULL) {
+    wattron(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+    wprintw(WTOP, "  %s", list_dir_label());
+    wattroff(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+  }
+
   wclrtoeol(WTOP);
   wrefresh(WTOP);
 }
@@ -99,21 +118,42 @@ void display_update_bot(void) {
   struct passwd* pws;
   struct group* grp;
 
-  const Entry* current = &ENTRIES[STATE->pos];
+  char user[32] = "?";
+  char group[32] = "?";
+  char pending[32] = "";
+
+  list_dir_load(STATE->pos, STATE->pos+1);
+
+  const Entry* current = entry_at(STATE->pos);
+
+  if (current->loaded) {
+    if ((pws = getpwuid(current->info.uid)) != NULL)
+      strlcpy(user, pws->pw_name, sizeof(user));
+    else
+      snprintf(user, sizeof(user), "%i", current->info.uid);
 
-  pws = getpwuid(current->info.st_uid);
-  grp = getgrgid(current->info.st_gid);
+    if ((grp = getgrgid(current->info.gid)) != NULL)
+      strlcpy(group, grp->gr_name, sizeof(group));
+    else
+      snprintf(group, sizeof(group), "%i", current->info.gid);
 
-  get_mode_line(mode, current);
-  get_size_line(sizeof(size), size, current);
-  get_time_line(sizeof(ctime), ctime, current->info.st_ctim.tv_sec);
+    get_mode_line(mode, current);
+    get_size_line(sizeof(size), size, current);
+    get_time_line(sizeof(ctime), ctime, current->info.ctime);
+  }
+
+  // directory or metadata still loading in the background
+  if (list_dir_reading())
+    strlcpy(pending, " reading", sizeof(pending));
+  else if (list_dir_pending() > 0)
+    snprintf(pending, sizeof(pending), " loading %zu", list_dir_pending());
 
   wattron(WBOT, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_DIM);
   mvwaddstr(WBOT, 0, 0, mode);
   wattroff(WBOT, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_DIM);
 
   wattron(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
-  mvwprintw(WBOT, 0, 11, "%s %s %s %s [%zu/%zu] (%c)", pws->pw_name, grp->gr_name, size, ctime, STATE->pos+1, STATE->files_n, STATE->order);
+  mvwprintw(WBOT, 0, 11, "%s %s %s %s [%zu/%zu] (%c%s)", user, group, size, ctime, STATE->pos+1, STATE->files_n, STATE->order, pending);
   wattroff(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
 
   wclrtoeol(WBOT);
@@ -128,6 +168,9 @@ void display_update_lft(void) {
 
   werase(WLFT);
 
+  // visible rows get their metadata first
+  list_dir_load(STATE->start_pos, STATE->end_pos+1);
+
   for (size_t l = 0, i = STATE->start_pos; i <= STATE->end_pos && l < (size_t) lines; i++, l++) {
 
     if (l == STATE->pos - STATE->start_pos) {
@@ -136,10 +179,11 @@ void display_update_lft(void) {
       wattroff(WLFT, COLOR_PAIR(PAIR_RED_BLACK) | A_BOLD);
     }
 
-    int attr = get_entry_attrs(&ENTRIES[i]);
+    const Entry* entry = entry_at(i);
+    int attr = get_entry_attrs(entry);
 
     wattron(WLFT, attr);
-    mvwaddnstr(WLFT, l, 2, ENTRIES[i].name, cols-3);
+    mvwaddnstr(WLFT, l, 2, entry->name, cols-3);
     wattroff(WLFT, attr);
   }
 
@@ -150,15 +194,17 @@ void display_update_lft(void) {
 void display_update_rgt(bool update_preview) {
   if (STATE->files_n == 0) return;
 
-  Entry* current = &ENTRIES[STATE->pos];
+  list_dir_load(STATE->pos, STATE->pos+1);
+
+  Entry* current = entry_at(STATE->pos);
 
   preview_clear(PREVIEW, WRGT);
 
   // preview directory
-  if (update_preview && S_ISDIR(current->info.st_mode))
+  if (update_preview && S_ISDIR(current->info.mode))
     preview_directory(PREVIEW, WRGT, current);
 
-  else if (update_preview && S_ISREG(current->info.st_mode) && current->info.st_mode & S_IRUSR) {
+  else if (update_preview && S_ISREG(current->info.mode) && current->info.mode & S_IRUSR) {
     if (current->type == unknown) {
       // if type is unknown get it from mime type
       char mime[64] = "";
@@ -176,6 +222,92 @@ void display_update_rgt(bool update_preview) {
 }
 
 
+void display_update_filter(const char* query, size_t matches) {
+  wattron(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+  mvwprintw(WTOP, 0, strlen(USER) + strlen(HOST) + strlen(CURRENT_DIR) + 3, "  [%zu] %s", matches, query);
+  wattroff(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+
+  wclrtoeol(WTOP);
+  wrefresh(WTOP);
+}
+
+
+void display_update_prompt(const char* prompt, const char* text) {
+  wattron(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+  mvwprintw(WTOP, 0, strlen(USER) + strlen(HOST) + strlen(CURRENT_DIR) + 3, "  %s %s", prompt, text);
+  wattroff(WTOP, COLOR_PAIR(PAIR_YELLOW_BLACK) | A_BOLD);
+
+  wclrtoeol(WTOP);
+  wrefresh(WTOP);
+}
+
+
+void display_update_found(const char* root, bool walking) {
+  int lines, cols;
+
+  getmaxyx(WLFT, lines, cols);
+
+  werase(WLFT);
+
+  if (STATE->files_n == 0)
+    mvwaddstr(WLFT, 0, 0, walking ? "  [Finding]" : "  [No Match]");
+
+  for (size_t l = 0, i = STATE->start_pos; i <= STATE->end_pos && i < STATE->files_n && l < (size_t) lines; i++, l++) {
+
+    if (l == STATE->pos - STATE->start_pos) {
+      wattron(WLFT, COLOR_PAIR(PAIR_RED_BLACK) | A_BOLD);
+      mvwaddch(WLFT, l, 0, '>');
+      wattroff(WLFT, COLOR_PAIR(PAIR_RED_BLACK) | A_BOLD);
+    }
+
+    mvwaddnstr(WLFT, l, 2, finder_match(i), cols-3);
+  }
+
+  wrefresh(WLFT);
+
+  wattron(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
+  mvwprintw(WBOT, 0, 0, "%s [%zu/%zu] found %zu%s", root, STATE->files_n > 0 ? STATE->pos+1 : 0, STATE->files_n,
+            finder_found(), walking ? " finding" : "");
+  wattroff(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
+
+  wclrtoeol(WBOT);
+  wrefresh(WBOT);
+}
+
+
+void display_update_jump(void) {
+  int lines, cols;
+
+  getmaxyx(WLFT, lines, cols);
+
+  werase(WLFT);
+
+  if (STATE->files_n == 0) mvwaddstr(WLFT, 0, 0, "  [No Match]");
+
+  for (size_t l = 0, i = STATE->start_pos; i <= STATE->end_pos && i < STATE->files_n && l < (size_t) lines; i++, l++) {
+
+    if (l == STATE->pos - STATE->start_pos) {
+      wattron(WLFT, COLOR_PAIR(PAIR_RED_BLACK) | A_BOLD);
+      mvwaddch(WLFT, l, 0, '>');
+      wattroff(WLFT, COLOR_PAIR(PAIR_RED_BLACK) | A_BOLD);
+    }
+
+    wattron(WLFT, COLOR_PAIR(PAIR_BLUE_BLACK) | A_BOLD);
+    mvwaddnstr(WLFT, l, 2, frecency_match(i), cols-3);
+    wattroff(WLFT, COLOR_PAIR(PAIR_BLUE_BLACK) | A_BOLD);
+  }
+
+  wrefresh(WLFT);
+
+  wattron(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
+  mvwprintw(WBOT, 0, 0, "jump to [%zu/%zu]", STATE->files_n > 0 ? STATE->pos+1 : 0, STATE->files_n);
+  wattroff(WBOT, COLOR_PAIR(PAIR_DEFAULT) | A_DIM);
+
+  wclrtoeol(WBOT);
+  wrefresh(WBOT);
+}
+
+
 void display_error(const char* error) {
   int lines __attribute__((unused)), cols;
 
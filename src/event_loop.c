@@ -101,6 +101,47 @@ void event_loop(void) {
   while ((ch = getch())) {
     ks = update_key_state(ks, ch);
 
+    // keys make the find query, while the paths found come in
+    if (action_finding()) {
+      if (ch != ERR) action_find_key(ch);
+      if (action_finding()) action_find_more();
+
+      timeout(finder_walking() ? 20 : 100);
+      continue;
+    }
+
+    // keys make the jump query
+    if (action_jumping()) {
+      if (ch != ERR) action_jump_key(ch);
+
+      timeout(100);
+      continue;
+    }
+
+    // keys make the metadata query
+    if (action_querying()) {
+      if (ch != ERR) action_query_key(ch);
+
+      timeout(100);
+      continue;
+    }
+
+    // keys make the pattern to select by
+    if (action_selecting_matching()) {
+      if (ch != ERR) action_select_matching_key(ch);
+
+      timeout(100);
+      continue;
+    }
+
+    // keys make the filter query (the directory stays as it is meanwhile)
+    if (action_filtering()) {
+      if (ch != ERR) action_filter_key(ch);
+
+      timeout(100);
+      continue;
+    }
+
     if (ch == 'q')
       break;
 
@@ -139,15 +180,34 @@ void event_loop(void) {
     else if (ks.state == key_down && ch == ' ')
       action_select();
 
+    else if (ks.state == key_down && ch == 'a')
+      action_select_all();
+
+    else if (ks.state == key_down && ch == 'A')
+      action_select_invert();
+
+    else if (ks.state == key_down && ch == 'm')
+      action_select_matching();
+
+    else if (ks.state == key_down && ch == 'M')
+      action_select_kind();
+
 
     else if (ks.state == key_down && ch == 'i')
       action_show_info();
 
+    else if (ks.state == key_down && ch == 'I')
+      action_show_cache_info();
+
     else if (ks.state == key_down && ch == 'p')
       display_update_rgt(true);
 
+    else if (ks.state == key_down && ch == '.')
+      action_toggle_hidden();
 
-    else if (ks.state == key_down && (ch == 't' || ch == 'T' || ch == 'n' || ch == 'N' || ch == 'z' || ch == 'Z'))
+
+    else if (ks.state == key_down && (ch == 't' || ch == 'T' || ch == 'n' || ch == 'N' || ch == 'z' || ch == 'Z' ||
+                                   ch == 'v' || ch == 'V' || ch == 'c' || ch == 'C'))
       action_reorder(ch);
 
     else if (ks.state == key_down && ch == 's')
@@ -159,9 +219,32 @@ void event_loop(void) {
     else if (ks.state == key_down && ch == '/')
       action_fzf_search();
 
+    else if (ks.state == key_down && ch == 'f')
+      action_filter();
+
+    else if (ks.state == key_down && ch == 'F')
+      action_find();
+
+    else if (ks.state == key_down && ch == 'g')
+      action_jump();
+
+    else if (ks.state == key_down && ch == '?')
+      action_query();
+
     else if (ch == KEY_RESIZE)
       action_resize_window();
 
-    events_consume(action_refresh, action_goto_home);
+    events_consume(action_refresh, action_entry_changed, action_goto_home);
+
+    // read directory and metadata in the background (without blocking on input meanwhile)
+    action_load_more();
+    action_load_metadata();
+
+    action_apply_changes();
+
+    // directories the user is likely to go to next are read while there's no input
+    if (ch == ERR) action_prefetch();
+
+    timeout(list_dir_reading() || list_dir_pending() > 0 || list_dir_changes() > 0 || list_prefetching() ? 10 : 100);
   }
 }
@@ -0,0 +1,366 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "raider.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// match scores (the best match of every name is ranked, scores are offset so
+// that they are never negative and counted into SCORE_MAX+1 buckets)
+#define SCORE_MATCH       16
+#define SCORE_GAP_START   -3
+#define SCORE_GAP         -1
+#define BONUS_START       10         // at the start of the name
+#define BONUS_BOUNDARY    8          // at the start of a word
+#define BONUS_CAMEL       7          // at a lowercase to uppercase change
+#define BONUS_CONSECUTIVE 4          // right after the previous character matched
+#define BONUS_FIRST       2          // the first character's bonus counts this many times
+#define SCORE_OFFSET      1024
+#define SCORE_MAX         4095
+
+// names filtered, lowercased and zero padded to 16 bytes (every name starts
+// at a 16 bytes boundary, so they can be scanned a block at a time)
+static char* HAYSTACK = NULL;
+static uint16_t* UPPER = NULL;       // characters of every block that were uppercase
+static uint32_t* OFFSETS = NULL;     // where names start (in 16 bytes blocks)
+static uint16_t* LENGTHS = NULL;
+static uint64_t* MASKS = NULL;       // characters in every name
+static size_t NAMES_N = 0;
+
+// matches of every prefix of the query (view positions in view order), their
+// scores and where the first match from the left ends (so that the next
+// character is only looked for from there on)
+static uint32_t* LEVEL_POS[FILTER_QUERY_MAX+1];
+static uint16_t* LEVEL_SCORE[FILTER_QUERY_MAX+1];
+static uint16_t* LEVEL_END[FILTER_QUERY_MAX+1];
+static size_t LEVEL_N[FILTER_QUERY_MAX+1];
+static size_t LEVEL_CAP[FILTER_QUERY_MAX+1];
+static char QUERY[FILTER_QUERY_MAX+1];
+static size_t DEPTH = 0;             // levels computed (for the first DEPTH characters of QUERY)
+
+// matches of the current query, best first
+static uint32_t* RANKED = NULL;
+
+
+// bit of a character in the masks (letters and digits have their own)
+static inline
+uint64_t char_bit(unsigned char c) {
+  if (c >= 'a' && c <= 'z') return UINT64_C(1) << (c - 'a');
+  if (c >= '0' && c <= '9') return UINT64_C(1) << (26 + c - '0');
+
+  return UINT64_C(1) << (36 + c % 28);
+}
+
+
+// position of c in name from i on (-1 if it isn't there)
+static inline
+int find_char(const char* name, int len, int i, char c) {
+#ifdef __SSE2__
+  const __m128i needle = _mm_set1_epi8(c);
+  int block = i & ~15;
+  unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*) (name + block)), needle));
+
+  mask &= ~0u << (i - block);
+
+  while (mask == 0) {
+    block += 16;
+
+    if (block >= len) return -1;
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*) (name + block)), needle));
+  }
+
+  // (the padding never matches)
+  return block + __builtin_ctz(mask);
+#else
+  const char* p = memchr(name + i, c, len - i);
+
+  return p != NULL ? (int) (p - name) : -1;
+#endif
+}
+
+
+static inline
+bool is_upper(const uint16_t* upper, int p) {
+  return upper[p/16] >> (p%16) & 1;
+}
+
+
+// (bytes of multibyte characters are taken as letters)
+static inline
+int boundary_bonus(const char* hay, const uint16_t* upper, int p) {
+  if (p == 0) return BONUS_START;
+
+  unsigned char prev = hay[p-1];
+
+  if (prev < 0x80 && !(prev >= 'a' && prev <= 'z') && !(prev >= '0' && prev <= '9')) return BONUS_BOUNDARY;
+  if (prev >= 'a' && prev <= 'z' && !is_upper(upper, p-1) && is_upper(upper, p)) return BONUS_CAMEL;
+
+  return 0;
+}
+
+
+// score of the best match of query in name i, given where the first match from
+// the left ends: that's the shortest window, which is matched backwards from its
+// end (so that the match is as tight as it gets)
+static inline
+int match_score(size_t i, const char* query, int m, int end) {
+  const char* hay = HAYSTACK + 16*(size_t) OFFSETS[i];
+  const uint16_t* upper = UPPER + OFFSETS[i];
+  int score = SCORE_OFFSET - LENGTHS[i]/8;   // shorter names first (among matches that are just as good)
+
+  if (m == 1) return score + SCORE_MATCH + BONUS_FIRST*boundary_bonus(hay, upper, end);
+
+  int pos[FILTER_QUERY_MAX];
+
+  for (int j = m-1, p = end; j >= 0; j--, p--) {
+    while (hay[p] != query[j]) p--;
+
+    pos[j] = p;
+  }
+
+  for (int j = 0; j < m; j++) {
+    int bonus = boundary_bonus(hay, upper, pos[j]);
+
+    if (j == 0) bonus *= BONUS_FIRST;
+    else if (pos[j] == pos[j-1] + 1) bonus = bonus > BONUS_CONSECUTIVE ? bonus : BONUS_CONSECUTIVE;
+    else score += SCORE_GAP_START + SCORE_GAP*(pos[j] - pos[j-1] - 2);
+
+    score += SCORE_MATCH + bonus;
+  }
+
+  return score < 0 ? 0 : score > SCORE_MAX ? SCORE_MAX : score;
+}
+
+
+// names to filter are the ones of the entries unless they're given
+static inline
+const char* name_at(const char* const* names, size_t i) {
+  return names != NULL ? names[i] : entry_at(i)->name;
+}
+
+
+bool filter_begin_names(size_t n, const char* const* names) {
+  filter_end();
+
+  size_t blocks = 0;
+  for (size_t i = 0; i < n; i++) blocks += strlen(name_at(names, i))/16 + 1;
+
+  if (posix_memalign((void**) &HAYSTACK, 16, 16*(blocks > 0 ? blocks : 1)) != 0) HAYSTACK = NULL;
+
+  UPPER = calloc(blocks + 1, sizeof(uint16_t));
+  OFFSETS = malloc(n*sizeof(uint32_t) + 1);
+  LENGTHS = malloc(n*sizeof(uint16_t) + 1);
+  MASKS = malloc(n*sizeof(uint64_t) + 1);
+  RANKED = malloc(n*sizeof(uint32_t) + 1);
+
+  if (HAYSTACK == NULL || UPPER == NULL || OFFSETS == NULL || LENGTHS == NULL || MASKS == NULL || RANKED == NULL) {
+    filter_end();
+    return false;
+  }
+
+  size_t block = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    const char* name = name_at(names, i);
+    char* hay = HAYSTACK + 16*block;
+    size_t len = strlen(name);
+    uint64_t mask = 0;
+
+    for (size_t k = 0; k < len; k++) {
+      unsigned char c = name[k];
+
+      if (c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+        UPPER[block + k/16] |= 1 << (k%16);
+      }
+
+      hay[k] = c;
+      mask |= char_bit(c);
+    }
+
+    memset(hay + len, 0, 16*(len/16 + 1) - len);
+
+    OFFSETS[i] = block;
+    LENGTHS[i] = len;
+    MASKS[i] = mask;
+
+    block += len/16 + 1;
+  }
+
+  NAMES_N = n;
+  DEPTH = 0;
+  QUERY[0] = '\0';
+
+  return true;
+}
+
+
+bool filter_begin(size_t n) {
+  return filter_begin_names(n, NULL);
+}
+
+
+// match the candidates of a level against the query up to the next one
+static
+bool level_compute(size_t k, const char* query) {
+  const uint32_t* from = k > 1 ? LEVEL_POS[k-1] : NULL;
+  const uint16_t* from_end = k > 1 ? LEVEL_END[k-1] : NULL;
+  size_t from_n = k > 1 ? LEVEL_N[k-1] : NAMES_N;
+
+  if (from_n > LEVEL_CAP[k]) {
+    uint32_t* pos = realloc(LEVEL_POS[k], from_n*sizeof(uint32_t));
+    if (pos == NULL) return false;
+    LEVEL_POS[k] = pos;
+
+    uint16_t* score = realloc(LEVEL_SCORE[k], from_n*sizeof(uint16_t));
+    if (score == NULL) return false;
+    LEVEL_SCORE[k] = score;
+
+    uint16_t* end = realloc(LEVEL_END[k], from_n*sizeof(uint16_t));
+    if (end == NULL) return false;
+    LEVEL_END[k] = end;
+
+    LEVEL_CAP[k] = from_n;
+  }
+
+  uint32_t* pos = LEVEL_POS[k];
+  uint16_t* score = LEVEL_SCORE[k];
+  uint16_t* end = LEVEL_END[k];
+
+  uint64_t mask = 0;
+  for (size_t j = 0; j < k; j++) mask |= char_bit(query[j]);
+
+  // names without some character of the query can't match (the candidates are
+  // collected without branching on it, as any of them is about as likely to fail)
+  size_t candidates = 0;
+
+  for (size_t c = 0; c < from_n; c++) {
+    uint32_t i = from != NULL ? from[c] : c;
+
+    pos[candidates] = c;
+    candidates += (mask & ~MASKS[i]) == 0;
+  }
+
+  size_t n = 0;
+
+  for (size_t j = 0; j < candidates; j++) {
+    uint32_t c = pos[j];
+    uint32_t i = from != NULL ? from[c] : c;
+    int p = find_char(HAYSTACK + 16*(size_t) OFFSETS[i], LENGTHS[i], from_end != NULL ? from_end[c] + 1 : 0, query[k-1]);
+
+    if (p < 0) continue;
+
+    pos[n] = i;
+    score[n] = match_score(i, query, k, p);
+    end[n] = p;
+    n++;
+  }
+
+  LEVEL_N[k] = n;
+
+  return true;
+}
+
+
+size_t filter_update(const char* query) {
+  char q[FILTER_QUERY_MAX+1];
+  size_t m = 0;
+
+  for (; query[m] != '\0' && m < FILTER_QUERY_MAX; m++)
+    q[m] = query[m] >= 'A' && query[m] <= 'Z' ? query[m] + 'a' - 'A' : query[m];
+  q[m] = '\0';
+
+  // levels of the part of the query that is the same are still good (typing
+  // one more character only goes through the matches of the previous ones)
+  size_t same = 0;
+  while (same < DEPTH && same < m && q[same] == QUERY[same]) same++;
+
+  memcpy(QUERY, q, m+1);
+
+  for (DEPTH = same; DEPTH < m; DEPTH++)
+    if (!level_compute(DEPTH+1, QUERY)) break;
+
+  if (DEPTH == 0) {
+    for (size_t i = 0; i < NAMES_N; i++) RANKED[i] = i;
+
+    return NAMES_N;
+  }
+
+  // rank the matches: counting them by score (best first) keeps the ones that
+  // score the same in view order
+  static size_t count[SCORE_MAX+2];
+  const uint16_t* score = LEVEL_SCORE[DEPTH];
+  size_t n = LEVEL_N[DEPTH];
+
+  memset(count, 0, sizeof(count));
+
+  for (size_t i = 0; i < n; i++) count[SCORE_MAX - score[i] + 1]++;
+  for (size_t s = 1; s <= SCORE_MAX+1; s++) count[s] += count[s-1];
+  for (size_t i = 0; i < n; i++) RANKED[count[SCORE_MAX - score[i]]++] = LEVEL_POS[DEPTH][i];
+
+  return n;
+}
+
+
+const uint32_t* filter_matches(void) {
+  return RANKED;
+}
+
+
+void filter_end(void) {
+  free(HAYSTACK);
+  free(UPPER);
+  free(OFFSETS);
+  free(LENGTHS);
+  free(MASKS);
+  free(RANKED);
+
+  for (size_t k = 0; k <= FILTER_QUERY_MAX; k++) {
+    free(LEVEL_POS[k]);
+    free(LEVEL_SCORE[k]);
+    free(LEVEL_END[k]);
+
+    LEVEL_POS[k] = NULL;
+    LEVEL_SCORE[k] = NULL;
+    LEVEL_END[k] = NULL;
+    LEVEL_N[k] = LEVEL_CAP[k] = 0;
+  }
+
+  HAYSTACK = NULL;
+  UPPER = NULL;
+  OFFSETS = NULL;
+  LENGTHS = NULL;
+  MASKS = NULL;
+  RANKED = NULL;
+  NAMES_N = 0;
+  DEPTH = 0;
+}
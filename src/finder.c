@@ -0,0 +1,853 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include "raider.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIND_MAX_THREADS 8
+
+// paths found are flushed to the results this many at a time (or when a
+// directory is done)
+#define FIND_BATCH 256
+
+// results are kept in chunks that never move (so they're read without locking)
+#define FIND_CHUNK_BITS 16
+#define FIND_CHUNK      (1 << FIND_CHUNK_BITS)
+#define FIND_CHUNKS     4096
+
+// longest .gitignore read
+#define IGNORE_MAX_LEN (64 * 1024)
+
+// a .gitignore pattern
+typedef struct {
+  const char* pattern;
+  bool        negated;               // (!) it brings back what was ignored
+  bool        dir_only;              // (trailing /) it only matches directories
+  bool        anchored;              // (has a /) it matches paths from the .gitignore directory
+  bool        any_depth;             // (leading **/) it matches paths from any directory below it
+} IgnoreRule;
+
+// the rules of a .gitignore (the ones of the directories above come after them)
+typedef struct Ignore {
+  const struct Ignore* parent;
+  struct Ignore*       next;         // (all of them are freed when finding stops)
+  size_t               base_len;     // length of the path of the .gitignore directory
+  size_t               n;
+  IgnoreRule           rules[];
+} Ignore;
+
+// a directory to read: it's opened relative to its parent, which stays open (and
+// in memory) as long as some of its subdirectories are still to be opened (linked
+// directories are opened from the root instead, after all the others)
+typedef struct FindDir {
+  struct FindDir* parent;
+  struct FindDir* next;              // (linked directories put aside)
+  const Ignore*   ignore;            // rules in effect here
+  int             fd;
+  int             refs;              // itself until read, plus its subdirectories until opened
+  size_t          name;              // where the name starts in path
+  size_t          depth;             // levels below the root
+  char            path[];            // relative to the root ("" for the root itself)
+} FindDir;
+
+// a thread walking the tree: it takes directories from the back of its own queue
+// and, when that is empty, from the front of the queue of the others
+typedef struct {
+  pthread_t       thread;
+  bool            started;
+  pthread_mutex_t lock;
+  FindDir**       queue;             // ring of cap directories from head (n of them)
+  size_t          cap;
+  size_t          head;
+  size_t          n;
+  Arena           paths;             // paths found by this thread
+  const char*     batch[FIND_BATCH]; // found but not in the results yet
+  size_t          batch_n;
+} FindWorker;
+
+static FindWorker WORKERS[FIND_MAX_THREADS];
+static size_t WORKERS_N = 0;
+static bool FIND_HIDDEN = false;
+static bool FIND_STOP = false;
+
+// what the paths found must match (metadata queries don't follow links or mind .gitignore)
+static const Query* FIND_QUERY = NULL;
+
+static size_t QUEUED = 0;            // directories in queues
+static size_t OUTSTANDING = 0;       // directories queued or being read
+static size_t SLEEPING = 0;          // workers waiting for directories
+static pthread_mutex_t IDLE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t IDLE_COND = PTHREAD_COND_INITIALIZER;
+
+// directories reached through links are walked once the others are done (so that
+// the ones inside the tree are found where they are, not through links to them)
+static int ROOT_FD = -1;
+static FindDir* LINKED = NULL;
+static size_t LINKED_N = 0;          // (they count as outstanding)
+static pthread_mutex_t LINKED_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// directories walked (device and inode), so that symbolic links don't loop
+static uint64_t* VISITED = NULL;     // pairs, (0, 0) for free slots
+static size_t VISITED_CAP = 0;
+static size_t VISITED_N = 0;
+static pthread_mutex_t VISITED_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static Ignore* IGNORES = NULL;
+static pthread_mutex_t IGNORES_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// paths found (relative to the root)
+static const char** RESULTS[FIND_CHUNKS];
+static size_t RESULTS_N = 0;
+static pthread_mutex_t RESULTS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// results matching the query (this part is only used by the main thread)
+static char QUERY[FILTER_QUERY_MAX+1] = "";
+static uint32_t* MATCHES = NULL;
+static size_t MATCHES_N = 0;
+static size_t MATCHES_CAP = 0;
+static size_t SCANNED = 0;           // results before this one are matched
+
+// the paths are looked up in the index instead (if one covers the root)
+static bool INDEXED = false;
+static size_t INDEXED_N = 0;         // paths under the root (matching an empty query)
+
+
+static
+size_t finder_threads(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus < 1) return 1;
+
+  return (size_t) cpus < FIND_MAX_THREADS ? (size_t) cpus : FIND_MAX_THREADS;
+}
+
+
+// add a directory to the visited ones, returns false if it was there already
+static
+bool visited_add(uint64_t dev, uint64_t ino) {
+  pthread_mutex_lock(&VISITED_LOCK);
+
+  if (2*(VISITED_N + 1) > VISITED_CAP) {
+    size_t cap = VISITED_CAP > 0 ? 2*VISITED_CAP : 1024;
+    uint64_t* slots = calloc(2*cap, sizeof(uint64_t));
+
+    if (slots == NULL) {
+      pthread_mutex_unlock(&VISITED_LOCK);
+      return true;
+    }
+
+    for (size_t i = 0; i < VISITED_CAP; i++) {
+      if (VISITED[2*i] == 0 && VISITED[2*i+1] == 0) continue;
+
+      size_t s = (VISITED[2*i]*0x9e3779b97f4a7c15 ^ VISITED[2*i+1]*0xff51afd7ed558ccd) & (cap-1);
+      while (slots[2*s] != 0 || slots[2*s+1] != 0) s = (s+1) & (cap-1);
+
+      slots[2*s] = VISITED[2*i];
+      slots[2*s+1] = VISITED[2*i+1];
+    }
+
+    free(VISITED);
+    VISITED = slots;
+    VISITED_CAP = cap;
+  }
+
+  size_t s = (dev*0x9e3779b97f4a7c15 ^ ino*0xff51afd7ed558ccd) & (VISITED_CAP-1);
+
+  for (; VISITED[2*s] != 0 || VISITED[2*s+1] != 0; s = (s+1) & (VISITED_CAP-1)) {
+    if (VISITED[2*s] == dev && VISITED[2*s+1] == ino) {
+      pthread_mutex_unlock(&VISITED_LOCK);
+      return false;
+    }
+  }
+
+  // (inode 0 is never used)
+  VISITED[2*s] = dev;
+  VISITED[2*s+1] = ino;
+  VISITED_N++;
+
+  pthread_mutex_unlock(&VISITED_LOCK);
+
+  return true;
+}
+
+
+// read the .gitignore in fd (NULL if there's none), base is the path of fd
+static
+Ignore* ignore_read(int fd, const char* base, const Ignore* parent) {
+  int ifd = openat(fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+
+  if (ifd < 0) return NULL;
+
+  char* text = malloc(IGNORE_MAX_LEN + 1);
+
+  if (text == NULL) {
+    close(ifd);
+    return NULL;
+  }
+
+  size_t len = 0;
+  ssize_t r;
+
+  while (len < IGNORE_MAX_LEN && (r = read(ifd, text + len, IGNORE_MAX_LEN - len)) > 0) len += r;
+  text[len] = '\0';
+
+  close(ifd);
+
+  size_t lines = 1;
+  for (size_t i = 0; i < len; i++) lines += text[i] == '\n';
+
+  // rules and their patterns go in one block
+  Ignore* ignore = malloc(sizeof(Ignore) + lines*sizeof(IgnoreRule) + len + 1);
+
+  if (ignore == NULL) {
+    free(text);
+    return NULL;
+  }
+
+  char* patterns = (char*) &ignore->rules[lines];
+  memcpy(patterns, text, len + 1);
+  free(text);
+
+  ignore->parent = parent;
+  ignore->base_len = strlen(base);
+  ignore->n = 0;
+
+  for (char* line = patterns; line != NULL; ) {
+    char* end = strchr(line, '\n');
+    char* next = end != NULL ? end + 1 : NULL;
+
+    if (end == NULL) end = line + strlen(line);
+
+    // trailing spaces don't count (and neither does a carriage return)
+    while (end > line && (end[-1] == ' ' || end[-1] == '\r')) end--;
+    *end = '\0';
+
+    IgnoreRule rule = { line, false, false, false, false };
+
+    if (rule.pattern[0] == '!') {
+      rule.negated = true;
+      rule.pattern++;
+    }
+
+    if (end > rule.pattern && end[-1] == '/') {
+      rule.dir_only = true;
+      *--end = '\0';
+    }
+
+    // (a leading **/ matches in any directory: with no other slash it's like a name)
+    while (strncmp(rule.pattern, "**/", 3) == 0) {
+      rule.any_depth = true;
+      rule.pattern += 3;
+    }
+
+    if (strchr(rule.pattern, '/') != NULL) {
+      rule.anchored = true;
+
+      if (rule.pattern[0] == '/' && !rule.any_depth) rule.pattern++;
+    }
+
+    if (rule.pattern[0] != '\0' && line[0] != '#') ignore->rules[ignore->n++] = rule;
+
+    line = next;
+  }
+
+  pthread_mutex_lock(&IGNORES_LOCK);
+  ignore->next = IGNORES;
+  IGNORES = ignore;
+  pthread_mutex_unlock(&IGNORES_LOCK);
+
+  return ignore;
+}
+
+
+// check if a rule with slashes matches rel (from any directory in it, if it can)
+static
+bool path_matches(const IgnoreRule* rule, const char* rel) {
+  for (const char* p = rel; p != NULL; p = rule->any_depth ? strchr(p, '/') : NULL) {
+    if (p != rel) p++;
+
+    if (fnmatch(rule->pattern, p, FNM_PATHNAME) == 0) return true;
+  }
+
+  return false;
+}
+
+
+// check if path is ignored (the last rule that matches it tells, deeper
+// .gitignore files first)
+static
+bool ignored(const Ignore* ignore, const char* path, const char* name, bool is_dir) {
+  for (; ignore != NULL; ignore = ignore->parent) {
+    const char* rel = path + ignore->base_len + (ignore->base_len > 0);
+
+    for (size_t k = ignore->n; k-- > 0; ) {
+      const IgnoreRule* rule = &ignore->rules[k];
+
+      if (rule->dir_only && !is_dir) continue;
+
+      if (rule->anchored ? path_matches(rule, rel) : fnmatch(rule->pattern, name, 0) == 0)
+        return !rule->negated;
+    }
+  }
+
+  return false;
+}
+
+
+static
+void dir_release(FindDir* dir) {
+  if (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+  if (dir->fd >= 0) close(dir->fd);
+
+  free(dir);
+}
+
+
+static
+void wake_workers(bool all) {
+  pthread_mutex_lock(&IDLE_LOCK);
+
+  if (all) pthread_cond_broadcast(&IDLE_COND);
+  else pthread_cond_signal(&IDLE_COND);
+
+  pthread_mutex_unlock(&IDLE_LOCK);
+}
+
+
+// (outstanding tells if dir is counted as outstanding already)
+static
+bool queue_push(FindWorker* w, FindDir* dir, bool outstanding) {
+  pthread_mutex_lock(&w->lock);
+
+  if (w->n == w->cap) {
+    size_t cap = w->cap > 0 ? 2*w->cap : 64;
+    FindDir** queue = malloc(cap*sizeof(FindDir*));
+
+    if (queue == NULL) {
+      pthread_mutex_unlock(&w->lock);
+      return false;
+    }
+
+    for (size_t i = 0; i < w->n; i++) queue[i] = w->queue[(w->head + i) % w->cap];
+
+    free(w->queue);
+    w->queue = queue;
+    w->cap = cap;
+    w->head = 0;
+  }
+
+  w->queue[(w->head + w->n++) % w->cap] = dir;
+
+  pthread_mutex_unlock(&w->lock);
+
+  if (!outstanding) __atomic_add_fetch(&OUTSTANDING, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&QUEUED, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&SLEEPING, __ATOMIC_SEQ_CST) > 0) wake_workers(false);
+
+  return true;
+}
+
+
+// take a directory from the back of the queue of w (or the front, if stealing)
+static
+FindDir* queue_pop(FindWorker* w, bool steal) {
+  FindDir* dir = NULL;
+
+  pthread_mutex_lock(&w->lock);
+
+  if (w->n > 0) {
+    if (steal) {
+      dir = w->queue[w->head];
+      w->head = (w->head + 1) % w->cap;
+    }
+    else dir = w->queue[(w->head + w->n - 1) % w->cap];
+
+    w->n--;
+  }
+
+  pthread_mutex_unlock(&w->lock);
+
+  if (dir != NULL) __atomic_sub_fetch(&QUEUED, 1, __ATOMIC_SEQ_CST);
+
+  return dir;
+}
+
+
+static
+void results_flush(FindWorker* w) {
+  if (w->batch_n == 0) return;
+
+  pthread_mutex_lock(&RESULTS_LOCK);
+
+  size_t n = RESULTS_N;
+
+  for (size_t i = 0; i < w->batch_n && n < (size_t) FIND_CHUNKS*FIND_CHUNK; i++, n++) {
+    const char*** chunk = &RESULTS[n >> FIND_CHUNK_BITS];
+
+    if (*chunk == NULL && (*chunk = malloc(FIND_CHUNK*sizeof(const char*))) == NULL) break;
+
+    (*chunk)[n & (FIND_CHUNK-1)] = w->batch[i];
+  }
+
+  // the main thread reads up to RESULTS_N (what's before it is written by now)
+  __atomic_store_n(&RESULTS_N, n, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&RESULTS_LOCK);
+
+  w->batch_n = 0;
+}
+
+
+static
+void results_add(FindWorker* w, const char* path, size_t len) {
+  char* p = arena_strdup(&w->paths, path, len);
+
+  if (p == NULL) return;
+
+  w->batch[w->batch_n++] = p;
+
+  if (w->batch_n == FIND_BATCH) results_flush(w);
+}
+
+
+static
+void dir_read(FindWorker* w, FindDir* dir) {
+  // open it relative to the parent (that can go once all its subdirectories are open)
+  if (dir->parent != NULL) {
+    if (!__atomic_load_n(&FIND_STOP, __ATOMIC_RELAXED))
+      dir->fd = openat(dir->parent->fd, dir->path + dir->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    dir_release(dir->parent);
+    dir->parent = NULL;
+  }
+  else if (dir->fd < 0 && !__atomic_load_n(&FIND_STOP, __ATOMIC_RELAXED))
+    dir->fd = openat(ROOT_FD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (dir->fd < 0 || __atomic_load_n(&FIND_STOP, __ATOMIC_RELAXED)) return;
+
+  struct stat info;
+
+  if (fstat(dir->fd, &info) != 0 || !visited_add(info.st_dev, info.st_ino)) return;
+
+  const Ignore* ignore = FIND_QUERY == NULL ? ignore_read(dir->fd, dir->path, dir->ignore) : NULL;
+  if (ignore == NULL) ignore = dir->ignore;
+
+  // (the query tells how deep it's worth going)
+  bool deeper = FIND_QUERY == NULL || dir->depth + 1 < query_depth(FIND_QUERY);
+
+  DirReader reader;
+  int fd = dup(dir->fd);
+
+  if (fd < 0 || dir_reader_open_fd(&reader, fd) != 0) return;
+
+  size_t base = strlen(dir->path);
+  char path[PATH_MAX];
+  const char* name;
+  unsigned char type;
+
+  memcpy(path, dir->path, base);
+  if (base > 0) path[base++] = '/';
+
+  while (dir_reader_next(&reader, &name, &type)) {
+    if (__atomic_load_n(&FIND_STOP, __ATOMIC_RELAXED)) break;
+
+    if (name[0] == '.' && (!FIND_HIDDEN || strcmp(name, ".git") == 0)) continue;
+
+    size_t len = strlen(name);
+
+    if (base + len >= sizeof(path)) continue;
+
+    memcpy(path + base, name, len + 1);
+
+    // links to directories are followed (the visited ones are not walked again)
+    bool is_dir = type == DT_DIR;
+    bool is_link = type == DT_LNK;
+
+    if (FIND_QUERY != NULL) {
+      if (query_test(FIND_QUERY, dir->fd, name, type, dir->depth + 1)) results_add(w, path, base + len);
+
+      if (!deeper || type == DT_LNK || (type != DT_DIR && type != DT_UNKNOWN)) continue;
+
+      struct stat target;
+
+      if (type == DT_UNKNOWN && (fstatat(dir->fd, name, &target, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(target.st_mode)))
+        continue;
+
+      is_dir = true;
+    }
+    else if (type == DT_LNK || type == DT_UNKNOWN) {
+      struct stat target;
+
+      if (type == DT_UNKNOWN && fstatat(dir->fd, name, &target, AT_SYMLINK_NOFOLLOW) == 0)
+        is_link = S_ISLNK(target.st_mode);
+
+      is_dir = fstatat(dir->fd, name, &target, 0) == 0 && S_ISDIR(target.st_mode);
+    }
+
+    if (ignore != NULL && ignored(ignore, path, name, is_dir)) continue;
+
+    if (FIND_QUERY == NULL) results_add(w, path, base + len);
+
+    if (!is_dir) continue;
+
+    FindDir* sub = malloc(sizeof(FindDir) + base + len + 1);
+
+    if (sub == NULL) continue;
+
+    sub->parent = is_link ? NULL : dir;
+    sub->ignore = ignore;
+    sub->fd = -1;
+    sub->refs = 1;
+    sub->name = base;
+    sub->depth = dir->depth + 1;
+    memcpy(sub->path, path, base + len + 1);
+
+    if (is_link) {
+      pthread_mutex_lock(&LINKED_LOCK);
+      sub->next = LINKED;
+      LINKED = sub;
+      LINKED_N++;
+      __atomic_add_fetch(&OUTSTANDING, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&LINKED_LOCK);
+
+      continue;
+    }
+
+    __atomic_add_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+
+    if (!queue_push(w, sub, false)) {
+      dir_release(dir);
+      free(sub);
+    }
+  }
+
+  dir_reader_close(&reader);
+}
+
+
+// queue the linked directories once they're all that's left
+static
+void linked_release(FindWorker* w) {
+  pthread_mutex_lock(&LINKED_LOCK);
+
+  if (LINKED_N > 0 && __atomic_load_n(&OUTSTANDING, __ATOMIC_SEQ_CST) == LINKED_N) {
+    for (FindDir* dir = LINKED; dir != NULL; ) {
+      FindDir* next = dir->next;
+
+      if (!queue_push(w, dir, true)) {
+        free(dir);
+        __atomic_sub_fetch(&OUTSTANDING, 1, __ATOMIC_SEQ_CST);
+      }
+
+      dir = next;
+    }
+
+    LINKED = NULL;
+    LINKED_N = 0;
+  }
+
+  pthread_mutex_unlock(&LINKED_LOCK);
+}
+
+
+static
+void* worker_run(void* arg) {
+  FindWorker* w = (FindWorker*) arg;
+
+  for (;;) {
+    FindDir* dir = queue_pop(w, false);
+
+    for (size_t k = 1; dir == NULL && k < WORKERS_N; k++)
+      dir = queue_pop(&WORKERS[(w - WORKERS + k) % WORKERS_N], true);
+
+    if (dir != NULL) {
+      dir_read(w, dir);
+      dir_release(dir);
+      results_flush(w);
+
+      if (__atomic_sub_fetch(&OUTSTANDING, 1, __ATOMIC_SEQ_CST) == 0) wake_workers(true);
+      else linked_release(w);
+
+      continue;
+    }
+
+    if (__atomic_load_n(&OUTSTANDING, __ATOMIC_SEQ_CST) == 0) break;
+
+    // nothing to take, but the ones being read may have subdirectories yet
+    pthread_mutex_lock(&IDLE_LOCK);
+    __atomic_add_fetch(&SLEEPING, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&QUEUED, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&OUTSTANDING, __ATOMIC_SEQ_CST) > 0)
+      pthread_cond_wait(&IDLE_COND, &IDLE_LOCK);
+
+    __atomic_sub_fetch(&SLEEPING, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&IDLE_LOCK);
+  }
+
+  return NULL;
+}
+
+
+static
+bool walk_start(const char* root) {
+  FindDir* dir = malloc(sizeof(FindDir) + 1);
+
+  if (dir == NULL) return false;
+
+  dir->fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (dir->fd < 0 || (ROOT_FD = dup(dir->fd)) < 0) {
+    if (dir->fd >= 0) close(dir->fd);
+    free(dir);
+    return false;
+  }
+
+  dir->parent = NULL;
+  dir->ignore = NULL;
+  dir->refs = 1;
+  dir->name = 0;
+  dir->depth = 0;
+  dir->path[0] = '\0';
+
+  FIND_STOP = false;
+  WORKERS_N = finder_threads();
+
+  for (size_t t = 0; t < WORKERS_N; t++) {
+    memset(&WORKERS[t], 0, sizeof(FindWorker));
+    pthread_mutex_init(&WORKERS[t].lock, NULL);
+  }
+
+  queue_push(&WORKERS[0], dir, false);
+
+  size_t started = 0;
+
+  for (size_t t = 0; t < WORKERS_N; t++)
+    started += WORKERS[t].started = pthread_create(&WORKERS[t].thread, NULL, worker_run, &WORKERS[t]) == 0;
+
+  // (the queues of threads that didn't start are taken by the others)
+  if (started == 0) {
+    finder_stop();
+    return false;
+  }
+
+  return true;
+}
+
+
+bool finder_start(const char* root, bool hidden) {
+  finder_stop();
+
+  FIND_HIDDEN = hidden;
+
+  if (tree_index_begin(root)) {
+    INDEXED = true;
+    return true;
+  }
+
+  return walk_start(root);
+}
+
+
+bool finder_start_query(const char* root, bool hidden, const Query* query) {
+  finder_stop();
+
+  FIND_HIDDEN = hidden;
+  FIND_QUERY = query;
+
+  return walk_start(root);
+}
+
+
+bool finder_walking(void) {
+  return WORKERS_N > 0 && __atomic_load_n(&OUTSTANDING, __ATOMIC_SEQ_CST) > 0;
+}
+
+
+size_t finder_found(void) {
+  if (INDEXED) return INDEXED_N;
+
+  return __atomic_load_n(&RESULTS_N, __ATOMIC_ACQUIRE);
+}
+
+
+static
+bool query_match(const char* path) {
+  return QUERY[0] == '\0' || strcasestr(path, QUERY) != NULL;
+}
+
+
+void finder_query(const char* query) {
+  // a longer query only drops matches
+  bool narrower = strncmp(query, QUERY, strlen(QUERY)) == 0;
+
+  strlcpy(QUERY, query, sizeof(QUERY));
+
+  if (INDEXED) {
+    MATCHES_N = tree_index_query(QUERY, FIND_HIDDEN, &MATCHES, &MATCHES_CAP);
+    if (QUERY[0] == '\0') INDEXED_N = MATCHES_N;
+    return;
+  }
+
+  if (!narrower) {
+    MATCHES_N = SCANNED = 0;
+    return;
+  }
+
+  size_t n = 0;
+
+  for (size_t i = 0; i < MATCHES_N; i++)
+    if (query_match(finder_path(MATCHES[i]))) MATCHES[n++] = MATCHES[i];
+
+  MATCHES_N = n;
+}
+
+
+bool finder_update(void) {
+  if (INDEXED) return false;
+
+  size_t found = finder_found();
+  size_t n = MATCHES_N;
+
+  for (; SCANNED < found; SCANNED++) {
+    if (!query_match(finder_path(SCANNED))) continue;
+
+    if (MATCHES_N == MATCHES_CAP) {
+      size_t cap = MATCHES_CAP > 0 ? 2*MATCHES_CAP : 4096;
+      uint32_t* matches = realloc(MATCHES, cap*sizeof(uint32_t));
+
+      if (matches == NULL) break;
+
+      MATCHES = matches;
+      MATCHES_CAP = cap;
+    }
+
+    MATCHES[MATCHES_N++] = SCANNED;
+  }
+
+  return MATCHES_N != n;
+}
+
+
+size_t finder_matches(void) {
+  return MATCHES_N;
+}
+
+
+const char* finder_match(size_t i) {
+  if (INDEXED) return tree_index_path(MATCHES[i]);
+
+  return finder_path(MATCHES[i]);
+}
+
+
+const char* finder_path(size_t i) {
+  return RESULTS[i >> FIND_CHUNK_BITS][i & (FIND_CHUNK-1)];
+}
+
+
+void finder_stop(void) {
+  if (INDEXED) {
+    tree_index_end();
+
+    free(MATCHES);
+
+    MATCHES = NULL;
+    MATCHES_N = MATCHES_CAP = 0;
+    QUERY[0] = '\0';
+    INDEXED = false;
+    INDEXED_N = 0;
+  }
+
+  FIND_QUERY = NULL;
+
+  if (WORKERS_N == 0) return;
+
+  // the directories left are let go without reading them
+  __atomic_store_n(&FIND_STOP, true, __ATOMIC_RELAXED);
+  wake_workers(true);
+
+  for (size_t t = 0; t < WORKERS_N; t++)
+    if (WORKERS[t].started) pthread_join(WORKERS[t].thread, NULL);
+
+  // (if some thread didn't start its queue is still there)
+  for (size_t t = 0; t < WORKERS_N; t++) {
+    FindDir* dir;
+
+    while ((dir = queue_pop(&WORKERS[t], true)) != NULL) {
+      if (dir->parent != NULL) dir_release(dir->parent);
+      dir_release(dir);
+    }
+
+    free(WORKERS[t].queue);
+    arena_free(&WORKERS[t].paths);
+    pthread_mutex_destroy(&WORKERS[t].lock);
+  }
+
+  while (LINKED != NULL) {
+    FindDir* next = LINKED->next;
+    free(LINKED);
+    LINKED = next;
+  }
+
+  close(ROOT_FD);
+
+  for (size_t c = 0; c < FIND_CHUNKS && RESULTS[c] != NULL; c++) {
+    free(RESULTS[c]);
+    RESULTS[c] = NULL;
+  }
+
+  while (IGNORES != NULL) {
+    Ignore* next = IGNORES->next;
+    free(IGNORES);
+    IGNORES = next;
+  }
+
+  free(VISITED);
+  free(MATCHES);
+
+  VISITED = NULL;
+  VISITED_CAP = VISITED_N = 0;
+  MATCHES = NULL;
+  MATCHES_N = MATCHES_CAP = SCANNED = 0;
+  QUERY[0] = '\0';
+  RESULTS_N = 0;
+  LINKED_N = 0;
+  ROOT_FD = -1;
+  QUEUED = OUTSTANDING = 0;
+  WORKERS_N = 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "raider.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FRECENCY_MAGIC   "RDRFRC01"
+#define FRECENCY_MAX     1024              // directories kept
+#define FRECENCY_STRINGS (FRECENCY_MAX*96) // room for their paths
+#define FRECENCY_AGING   9000.0f           // ranks are aged when they add up to more than this
+
+// the database is a fixed size file (shared by all the instances of raider,
+// that lock it while they change it): header, directories and their paths
+typedef struct {
+  char     magic[8];
+  uint32_t n;
+  uint32_t strings_len;
+} FrecencyHeader;
+
+typedef struct {
+  uint64_t hash;
+  float    rank;                     // visits (aged)
+  uint32_t last;                     // last visit (seconds since the epoch)
+  uint32_t path;                     // offset in the strings
+  uint32_t len;
+} FrecencyEntry;
+
+typedef struct {
+  FrecencyHeader header;
+  FrecencyEntry  entries[FRECENCY_MAX];
+  char           strings[FRECENCY_STRINGS];
+} FrecencyDB;
+
+static int DB_FD = -1;
+static FrecencyDB* DB = NULL;
+static bool DB_FAILED = false;       // (it's not tried again)
+
+// directories ranked for the jump prompt (copied: other instances may change the database)
+static char** JUMP = NULL;
+static size_t JUMP_N = 0;
+
+
+// check that the paths of the directories are all inside the strings (the file
+// may be of another version, or half written)
+static
+bool db_valid(const FrecencyDB* db) {
+  if (memcmp(db->header.magic, FRECENCY_MAGIC, 8) != 0 || db->header.n > FRECENCY_MAX ||
+      db->header.strings_len > FRECENCY_STRINGS)
+    return false;
+
+  for (uint32_t i = 0; i < db->header.n; i++) {
+    const FrecencyEntry* e = &db->entries[i];
+
+    if (e->len >= db->header.strings_len || e->path > db->header.strings_len - e->len - 1 ||
+        db->strings[e->path + e->len] != '\0')
+      return false;
+  }
+
+  return true;
+}
+
+
+static
+bool db_open(void) {
+  if (DB != NULL) return true;
+  if (DB_FAILED) return false;
+
+  DB_FAILED = true;
+
+  char path[PATH_MAX];
+
+  if (!cache_dir(sizeof(path), path)) return false;
+
+  strlcat(path, "/frecency", sizeof(path));
+
+  if ((DB_FD = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) return false;
+
+  flock(DB_FD, LOCK_EX);
+
+  struct stat info;
+
+  // (a new or broken database starts empty)
+  if (fstat(DB_FD, &info) != 0 || info.st_size != sizeof(FrecencyDB)) {
+    if (ftruncate(DB_FD, 0) != 0 || ftruncate(DB_FD, sizeof(FrecencyDB)) != 0) {
+      flock(DB_FD, LOCK_UN);
+      close(DB_FD);
+      DB_FD = -1;
+      return false;
+    }
+  }
+
+  void* map = mmap(NULL, sizeof(FrecencyDB), PROT_READ | PROT_WRITE, MAP_SHARED, DB_FD, 0);
+
+  if (map == MAP_FAILED) {
+    flock(DB_FD, LOCK_UN);
+    close(DB_FD);
+    DB_FD = -1;
+    return false;
+  }
+
+  DB = (FrecencyDB*) map;
+
+  if (!db_valid(DB)) {
+    memset(DB, 0, sizeof(FrecencyHeader));
+    memcpy(DB->header.magic, FRECENCY_MAGIC, 8);
+  }
+
+  flock(DB_FD, LOCK_UN);
+
+  DB_FAILED = false;
+
+  return true;
+}
+
+
+// rank weighted by how long ago the last visit was
+static
+float frecency(const FrecencyEntry* e, uint32_t now) {
+  uint32_t age = now > e->last ? now - e->last : 0;
+
+  if (age < 3600) return 4*e->rank;
+  if (age < 86400) return 2*e->rank;
+  if (age < 604800) return e->rank/2;
+
+  return e->rank/4;
+}
+
+
+// drop the directories with no rank left (and the paths no one has)
+static
+void db_compact(void) {
+  char* strings = malloc(FRECENCY_STRINGS);
+  uint32_t len = 0, n = 0;
+
+  if (strings == NULL) return;
+
+  for (uint32_t i = 0; i < DB->header.n; i++) {
+    FrecencyEntry e = DB->entries[i];
+
+    if (e.rank <= 0) continue;
+
+    memcpy(strings + len, DB->strings + e.path, e.len + 1);
+    e.path = len;
+    len += e.len + 1;
+
+    DB->entries[n++] = e;
+  }
+
+  memcpy(DB->strings, strings, len);
+
+  DB->header.n = n;
+  DB->header.strings_len = len;
+
+  free(strings);
+}
+
+
+// make room for a path of len bytes, dropping the least frecent directories
+static
+void db_make_room(uint32_t len, uint32_t now) {
+  while (DB->header.n > 0 &&
+         (DB->header.n == FRECENCY_MAX || DB->header.strings_len + len + 1 > FRECENCY_STRINGS)) {
+    uint32_t worst = 0;
+
+    for (uint32_t i = 1; i < DB->header.n; i++)
+      if (frecency(&DB->entries[i], now) < frecency(&DB->entries[worst], now)) worst = i;
+
+    DB->entries[worst].rank = 0;
+    db_compact();
+  }
+}
+
+
+void frecency_visit(const char* dir) {
+  if (!db_open()) return;
+
+  uint64_t hash = fnv1a(dir, strlen(dir));
+  uint32_t len = strlen(dir);
+  uint32_t now = time(NULL);
+
+  if (len + 1 > FRECENCY_STRINGS) return;
+
+  flock(DB_FD, LOCK_EX);
+
+  FrecencyEntry* e = NULL;
+
+  for (uint32_t i = 0; i < DB->header.n && e == NULL; i++)
+    if (DB->entries[i].hash == hash && strcmp(DB->strings + DB->entries[i].path, dir) == 0) e = &DB->entries[i];
+
+  if (e == NULL) {
+    db_make_room(len, now);
+
+    e = &DB->entries[DB->header.n++];
+    e->hash = hash;
+    e->rank = 0;
+    e->path = DB->header.strings_len;
+    e->len = len;
+
+    memcpy(DB->strings + e->path, dir, len + 1);
+    DB->header.strings_len += len + 1;
+  }
+
+  e->rank += 1;
+  e->last = now;
+
+  // old visits count less and less (and directories not visited for long go)
+  float sum = 0;
+  for (uint32_t i = 0; i < DB->header.n; i++) sum += DB->entries[i].rank;
+
+  if (sum > FRECENCY_AGING) {
+    for (uint32_t i = 0; i < DB->header.n; i++) {
+      DB->entries[i].rank *= 0.9f;
+      if (DB->entries[i].rank < 1) DB->entries[i].rank = 0;
+    }
+
+    db_compact();
+  }
+
+  flock(DB_FD, LOCK_UN);
+}
+
+
+void frecency_forget(const char* dir) {
+  if (!db_open()) return;
+
+  uint64_t hash = fnv1a(dir, strlen(dir));
+
+  flock(DB_FD, LOCK_EX);
+
+  for (uint32_t i = 0; i < DB->header.n; i++)
+    if (DB->entries[i].hash == hash && strcmp(DB->strings + DB->entries[i].path, dir) == 0) {
+      DB->entries[i].rank = 0;
+      db_compact();
+      break;
+    }
+
+  flock(DB_FD, LOCK_UN);
+}
+
+
+typedef struct {
+  float    score;
+  uint32_t i;
+} Ranked;
+
+
+static
+int ranked_cmp(const void* a, const void* b) {
+  const Ranked* x = (const Ranked*) a;
+  const Ranked* y = (const Ranked*) b;
+
+  return x->score > y->score ? -1 : x->score < y->score ? 1 : (x->i > y->i) - (x->i < y->i);
+}
+
+
+bool frecency_begin(const char* current) {
+  frecency_end();
+
+  if (!db_open()) return false;
+
+  uint32_t now = time(NULL);
+  Ranked ranked[FRECENCY_MAX];
+  size_t n = 0;
+
+  flock(DB_FD, LOCK_SH);
+
+  for (uint32_t i = 0; i < DB->header.n; i++)
+    if (strcmp(DB->strings + DB->entries[i].path, current) != 0)
+      ranked[n++] = (Ranked) { frecency(&DB->entries[i], now), i };
+
+  qsort(ranked, n, sizeof(Ranked), ranked_cmp);
+
+  // (the matcher keeps this order among directories that match just as well)
+  JUMP = malloc((n + 1)*sizeof(char*));
+
+  for (size_t k = 0; JUMP != NULL && k < n; k++)
+    if ((JUMP[JUMP_N] = strdup(DB->strings + DB->entries[ranked[k].i].path)) != NULL) JUMP_N++;
+
+  flock(DB_FD, LOCK_UN);
+
+  if (JUMP == NULL || !filter_begin_names(JUMP_N, (const char* const*) JUMP)) {
+    frecency_end();
+    return false;
+  }
+
+  return true;
+}
+
+
+size_t frecency_query(const char* query) {
+  return filter_update(query);
+}
+
+
+const char* frecency_match(size_t i) {
+  return JUMP[filter_matches()[i]];
+}
+
+
+void frecency_end(void) {
+  if (JUMP == NULL) return;
+
+  filter_end();
+
+  for (size_t i = 0; i < JUMP_N; i++) free(JUMP[i]);
+  free(JUMP);
+
+  JUMP = NULL;
+  JUMP_N = 0;
+}
+
+
+void frecency_close(void) {
+  frecency_end();
+
+  if (DB != NULL) munmap(DB, sizeof(FrecencyDB));
+  if (DB_FD >= 0) close(DB_FD);
+
+  DB = NULL;
+  DB_FD = -1;
+}
@@ -0,0 +1,1241 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include "raider.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef LINUX_INOTIFY
+#include <sys/inotify.h>
+
+#define INDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+#endif
+
+#define INDEX_MAX_ROOTS 8
+#define INDEX_MAGIC     "RDRIDX01"
+
+// trigrams of 6 bits characters (letters and digits have their own, the rest
+// share some: the paths that match are checked anyway)
+#define TRIGRAMS (1 << 18)
+
+// paths (and directories) added since the index was built are referred to with this bit set
+#define ADDED_BIT 0x80000000u
+#define NO_REF    UINT32_MAX
+
+// the index is built again when this many paths changed since (or an eighth of them)
+#define REBUILD_MIN 65536
+
+// how long the index thread waits for events
+#define INDEX_POLL_MS 100
+
+// how often the times of the directories are checked when some are not watched
+#define INDEX_RECHECK_S 10
+
+// the index file is: header, root path, path offsets, directories, trigram
+// offsets, paths and postings (sections are 8 bytes aligned)
+typedef struct {
+  char     magic[8];
+  uint64_t paths_n;
+  uint64_t dirs_n;
+  uint64_t strings_len;
+  uint64_t postings_len;
+  uint64_t root_len;
+  uint64_t dev;                      // device of the root (other file systems are not indexed)
+} IndexHeader;
+
+// a directory (its entries are the paths from first to first+n)
+typedef struct {
+  uint32_t path;                     // (NO_REF for the root)
+  uint32_t first;
+  uint32_t n;
+  uint32_t pad;
+  int64_t  mtime_sec;                // modification time when it was read
+  int64_t  mtime_nsec;
+} IndexDir;
+
+// a path added since the index was built
+typedef struct {
+  const char* path;
+  uint32_t    parent;                // directory it's in (index or ADDED_BIT and position in added)
+  bool        is_dir;
+  bool        removed;
+  int64_t     mtime_sec;
+  int64_t     mtime_nsec;
+} IndexAdded;
+
+// per trigram posting list being built
+typedef struct {
+  uint8_t* buf;
+  uint32_t len;
+  uint32_t cap;
+  uint32_t last;                     // last path added (+1)
+} Posting;
+
+typedef struct {
+  char             root[PATH_MAX];
+  size_t           root_len;
+  char             file[PATH_MAX];
+  int              root_fd;
+  uint64_t         dev;
+
+  pthread_t        thread;
+  bool             started;
+  bool             stop;
+  bool             ready;            // it can be queried
+  int              pins;             // queries using it (it's not swapped meanwhile)
+  pthread_mutex_t  lock;             // (the index thread changes it, queries read it)
+
+  // the index as it was built (mapped from its file)
+  char*            map;
+  size_t           map_len;
+  const IndexHeader* header;
+  const uint64_t*  path_offs;
+  IndexDir*        dirs;             // (privately mapped: their times are updated)
+  const uint64_t*  post_offs;
+  const char*      strings;
+  const uint8_t*   postings;
+  uint64_t*        removed;          // paths removed since
+  size_t           removed_n;
+
+  IndexAdded*      added;
+  size_t           added_n;
+  size_t           added_cap;
+  Arena            added_paths;
+
+  int              in_fd;            // directories watched (refs by watch descriptor)
+  uint32_t*        watches;
+  size_t           watches_cap;
+  bool             unwatched;        // some directory could not be watched
+} Index;
+
+static Index* INDEXES[INDEX_MAX_ROOTS];
+static size_t INDEXES_N = 0;
+
+// the index queried by the search (and where the search is, under its root)
+static Index* PINNED = NULL;
+static size_t PINNED_PREFIX = 0;
+static char PINNED_DIR[PATH_MAX] = "";
+
+
+static inline
+uint32_t trigram_char(unsigned char c) {
+  if (c >= 'a' && c <= 'z') return c - 'a';
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= '0' && c <= '9') return 26 + c - '0';
+  if (c == '.') return 36;
+  if (c == '_') return 37;
+  if (c == '-') return 38;
+  if (c == '/') return 39;
+  if (c == ' ') return 40;
+  if (c >= 0x80) return 41 + (c & 15);
+
+  return 57 + c % 7;
+}
+
+
+static inline
+uint32_t trigram(const char* s) {
+  return trigram_char(s[0]) << 12 | trigram_char(s[1]) << 6 | trigram_char(s[2]);
+}
+
+
+static
+bool posting_add(Posting* p, uint32_t id) {
+  if (p->last == id + 1) return true;
+
+  // (ids go up: the gaps are stored, 7 bits at a time)
+  uint32_t gap = p->last == 0 ? id : id - (p->last - 1);
+
+  if (p->len + 5 > p->cap) {
+    uint32_t cap = p->cap > 0 ? 2*p->cap : 16;
+    uint8_t* buf = realloc(p->buf, cap);
+
+    if (buf == NULL) return false;
+
+    p->buf = buf;
+    p->cap = cap;
+  }
+
+  for (; gap >= 0x80; gap >>= 7) p->buf[p->len++] = (uint8_t) (gap | 0x80);
+  p->buf[p->len++] = (uint8_t) gap;
+
+  p->last = id + 1;
+
+  return true;
+}
+
+
+// decode a posting list (n ids at most)
+static
+size_t posting_decode(const uint8_t* p, const uint8_t* end, uint32_t* ids) {
+  size_t n = 0;
+  uint32_t id = 0;
+
+  while (p < end) {
+    uint32_t gap = 0;
+
+    for (int shift = 0; p < end; shift += 7) {
+      gap |= (uint32_t) (*p & 0x7f) << shift;
+      if (!(*p++ & 0x80)) break;
+    }
+
+    id = n == 0 ? gap : id + gap;
+    ids[n++] = id;
+  }
+
+  return n;
+}
+
+
+// keep the ids that are in the posting list too
+static
+size_t posting_intersect(const uint8_t* p, const uint8_t* end, uint32_t* ids, size_t n) {
+  size_t i = 0, m = 0;
+  uint32_t id = 0;
+  bool first = true;
+
+  while (p < end && i < n) {
+    uint32_t gap = 0;
+
+    for (int shift = 0; p < end; shift += 7) {
+      gap |= (uint32_t) (*p & 0x7f) << shift;
+      if (!(*p++ & 0x80)) break;
+    }
+
+    id = first ? gap : id + gap;
+    first = false;
+
+    while (i < n && ids[i] < id) i++;
+    if (i < n && ids[i] == id) ids[m++] = ids[i++];
+  }
+
+  return m;
+}
+
+
+// mark the ids of a posting list
+static
+void posting_mark(const uint8_t* p, const uint8_t* end, uint64_t* marked) {
+  uint32_t id = 0;
+  bool first = true;
+
+  while (p < end) {
+    uint32_t gap = 0;
+
+    for (int shift = 0; p < end; shift += 7) {
+      gap |= (uint32_t) (*p & 0x7f) << shift;
+      if (!(*p++ & 0x80)) break;
+    }
+
+    id = first ? gap : id + gap;
+    first = false;
+
+    marked[id/64] |= UINT64_C(1) << (id%64);
+  }
+}
+
+
+static
+bool grow(void** array, size_t* cap, size_t n, size_t size) {
+  if (n < *cap) return true;
+
+  size_t new_cap = *cap > 0 ? 2*(*cap) : 1024;
+  void* tmp = realloc(*array, new_cap*size);
+
+  if (tmp == NULL) return false;
+
+  *array = tmp;
+  *cap = new_cap;
+
+  return true;
+}
+
+
+static
+bool write_padded(FILE* f, const void* data, size_t len) {
+  static const char zeros[8] = { 0 };
+
+  return fwrite(data, 1, len, f) == len && fwrite(zeros, 1, (8 - len % 8) % 8, f) == (8 - len % 8) % 8;
+}
+
+
+// read the whole tree (breadth first, so that the entries of every directory
+// are next to each other) and write the index file
+static
+bool index_build(Index* ix) {
+  char* strings = NULL;
+  size_t strings_len = 0, strings_cap = 0;
+  uint64_t* offs = NULL;
+  size_t paths_n = 0, offs_cap = 0;
+  IndexDir* dirs = NULL;
+  size_t dirs_n = 0, dirs_cap = 0;
+  Posting* postings = NULL;
+  bool ok = false;
+
+  if (!grow((void**) &dirs, &dirs_cap, 0, sizeof(IndexDir))) goto done;
+
+  dirs[dirs_n++] = (IndexDir) { .path = NO_REF };
+
+  for (size_t k = 0; k < dirs_n; k++) {
+    if (__atomic_load_n(&ix->stop, __ATOMIC_RELAXED)) goto done;
+
+    char dir[PATH_MAX] = "";
+
+    if (dirs[k].path != NO_REF) strlcpy(dir, strings + offs[dirs[k].path], sizeof(dir));
+
+    int fd = openat(ix->root_fd, k > 0 ? dir : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat info;
+
+    dirs[k].first = paths_n;
+
+    if (fd < 0) continue;
+
+    if (fstat(fd, &info) != 0 || (uint64_t) info.st_dev != ix->dev) {
+      close(fd);
+      continue;
+    }
+
+    dirs[k].mtime_sec = info.st_mtim.tv_sec;
+    dirs[k].mtime_nsec = info.st_mtim.tv_nsec;
+
+    DirReader reader;
+    const char* name;
+    unsigned char type;
+    size_t dir_len = strlen(dir);
+
+    if (dir_reader_open_fd(&reader, fd) != 0) continue;
+
+    while (dir_reader_next(&reader, &name, &type)) {
+      if (strcmp(name, ".git") == 0) continue;
+
+      size_t len = dir_len + (dir_len > 0) + strlen(name);
+
+      if (len >= PATH_MAX || paths_n >= ADDED_BIT - 1) continue;
+
+      while (strings_len + len + 1 > strings_cap) {
+        size_t cap = strings_cap > 0 ? 2*strings_cap : 1 << 20;
+        char* tmp = realloc(strings, cap);
+
+        if (tmp == NULL) goto done;
+
+        strings = tmp;
+        strings_cap = cap;
+      }
+
+      if (!grow((void**) &offs, &offs_cap, paths_n + 1, sizeof(uint64_t))) goto done;
+
+      char* path = strings + strings_len;
+      snprintf(path, len + 1, "%s%s%s", dir, dir_len > 0 ? "/" : "", name);
+
+      offs[paths_n] = strings_len;
+      strings_len += len + 1;
+
+      if (type == DT_UNKNOWN) {
+        struct stat entry;
+        if (fstatat(reader.fd, name, &entry, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry.st_mode)) type = DT_DIR;
+      }
+
+      // (links are not followed)
+      if (type == DT_DIR) {
+        if (!grow((void**) &dirs, &dirs_cap, dirs_n, sizeof(IndexDir))) goto done;
+
+        dirs[dirs_n++] = (IndexDir) { .path = paths_n };
+      }
+
+      paths_n++;
+    }
+
+    dir_reader_close(&reader);
+
+    dirs[k].n = paths_n - dirs[k].first;
+  }
+
+  offs = realloc(offs, (paths_n + 1)*sizeof(uint64_t));
+  if (offs == NULL) goto done;
+  offs[paths_n] = strings_len;
+
+  // every path is in the list of all of its trigrams
+  postings = calloc(TRIGRAMS, sizeof(Posting));
+  if (postings == NULL) goto done;
+
+  for (size_t id = 0; id < paths_n; id++) {
+    const char* path = strings + offs[id];
+    size_t len = offs[id+1] - offs[id] - 1;
+
+    for (size_t i = 0; i + 3 <= len; i++)
+      if (!posting_add(&postings[trigram(path + i)], id)) goto done;
+  }
+
+  uint64_t* post_offs = malloc((TRIGRAMS + 1)*sizeof(uint64_t));
+  if (post_offs == NULL) goto done;
+
+  post_offs[0] = 0;
+  for (size_t t = 0; t < TRIGRAMS; t++) post_offs[t+1] = post_offs[t] + postings[t].len;
+
+  IndexHeader header = {
+    .magic        = INDEX_MAGIC,
+    .paths_n      = paths_n,
+    .dirs_n       = dirs_n,
+    .strings_len  = strings_len,
+    .postings_len = post_offs[TRIGRAMS],
+    .root_len     = ix->root_len,
+    .dev          = ix->dev
+  };
+
+  // written aside and renamed (the old one may still be mapped)
+  char tmp[PATH_MAX+16];
+  snprintf(tmp, sizeof(tmp), "%s.%i", ix->file, getpid());
+
+  FILE* f = fopen(tmp, "w");
+
+  if (f != NULL) {
+    ok = write_padded(f, &header, sizeof(header)) &&
+         write_padded(f, ix->root, ix->root_len) &&
+         write_padded(f, offs, (paths_n + 1)*sizeof(uint64_t)) &&
+         write_padded(f, dirs, dirs_n*sizeof(IndexDir)) &&
+         write_padded(f, post_offs, (TRIGRAMS + 1)*sizeof(uint64_t)) &&
+         write_padded(f, strings, strings_len);
+
+    for (size_t t = 0; ok && t < TRIGRAMS; t++)
+      ok = postings[t].len == 0 || fwrite(postings[t].buf, 1, postings[t].len, f) == postings[t].len;
+
+    ok = fclose(f) == 0 && ok && rename(tmp, ix->file) == 0;
+
+    if (!ok) unlink(tmp);
+  }
+
+  free(post_offs);
+
+ done:
+  if (postings != NULL)
+    for (size_t t = 0; t < TRIGRAMS; t++) free(postings[t].buf);
+
+  free(postings);
+  free(strings);
+  free(offs);
+  free(dirs);
+
+  return ok;
+}
+
+
+static
+void index_unmap(Index* ix) {
+  if (ix->map != NULL) munmap(ix->map, ix->map_len);
+  free(ix->removed);
+
+  ix->map = NULL;
+  ix->removed = NULL;
+  ix->removed_n = 0;
+  ix->added_n = 0;
+  arena_reset(&ix->added_paths);
+}
+
+
+static inline
+size_t padded(size_t len) {
+  return (len + 7) & ~(size_t) 7;
+}
+
+
+// map the index file (it must be of the same root)
+static
+bool index_map(Index* ix) {
+  int fd = open(ix->file, O_RDONLY | O_CLOEXEC);
+  struct stat info;
+
+  if (fd < 0) return false;
+
+  if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(IndexHeader)) {
+    close(fd);
+    return false;
+  }
+
+  char* map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) return false;
+
+  const IndexHeader* h = (const IndexHeader*) map;
+  size_t len = padded(sizeof(IndexHeader)) + padded(h->root_len) + padded((h->paths_n + 1)*sizeof(uint64_t)) +
+               padded(h->dirs_n*sizeof(IndexDir)) + padded((TRIGRAMS + 1)*sizeof(uint64_t)) +
+               padded(h->strings_len) + h->postings_len;
+
+  if (memcmp(h->magic, INDEX_MAGIC, 8) != 0 || len != (size_t) info.st_size || h->dirs_n == 0 ||
+      h->paths_n >= ADDED_BIT || h->dev != ix->dev || h->root_len != ix->root_len ||
+      memcmp(map + padded(sizeof(IndexHeader)), ix->root, ix->root_len) != 0) {
+    munmap(map, info.st_size);
+    return false;
+  }
+
+  uint64_t* removed = calloc(h->paths_n/64 + 1, sizeof(uint64_t));
+
+  if (removed == NULL) {
+    munmap(map, info.st_size);
+    return false;
+  }
+
+  char* p = map + padded(sizeof(IndexHeader)) + padded(h->root_len);
+
+  ix->map = map;
+  ix->map_len = info.st_size;
+  ix->header = h;
+  ix->path_offs = (const uint64_t*) p;    p += padded((h->paths_n + 1)*sizeof(uint64_t));
+  ix->dirs = (IndexDir*) p;               p += padded(h->dirs_n*sizeof(IndexDir));
+  ix->post_offs = (const uint64_t*) p;    p += padded((TRIGRAMS + 1)*sizeof(uint64_t));
+  ix->strings = p;                        p += padded(h->strings_len);
+  ix->postings = (const uint8_t*) p;
+  ix->removed = removed;
+  ix->removed_n = 0;
+  ix->added_n = 0;
+
+  return true;
+}
+
+
+static inline
+const char* built_path(const Index* ix, uint32_t id) {
+  return ix->strings + ix->path_offs[id];
+}
+
+
+static inline
+bool is_removed(const Index* ix, uint32_t id) {
+  return ix->removed[id/64] >> (id%64) & 1;
+}
+
+
+// path of a directory ("" for the root)
+static
+const char* dir_path(const Index* ix, uint32_t ref) {
+  if (ref & ADDED_BIT) return ix->added[ref & ~ADDED_BIT].path;
+
+  return ix->dirs[ref].path == NO_REF ? "" : built_path(ix, ix->dirs[ref].path);
+}
+
+
+// the directory that path id is (NO_REF if it isn't one)
+static
+uint32_t built_dir(const Index* ix, uint32_t id) {
+  size_t lo = 1, hi = ix->header->dirs_n;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo)/2;
+
+    if (ix->dirs[mid].path < id) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo < ix->header->dirs_n && ix->dirs[lo].path == id ? lo : NO_REF;
+}
+
+
+static
+void watch_add(Index* ix, uint32_t ref) {
+#ifdef LINUX_INOTIFY
+  char path[PATH_MAX];
+  const char* rel = dir_path(ix, ref);
+
+#pragma GCC diagnostic push
+#ifndef __clang__
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#endif
+  snprintf(path, sizeof(path), "%s%s%s", ix->root, rel[0] != '\0' ? "/" : "", rel);
+#pragma GCC diagnostic pop
+
+  int wd = inotify_add_watch(ix->in_fd, path, INDEX_EVENTS);
+
+  if (wd < 0) {
+    ix->unwatched = true;
+    return;
+  }
+
+  while ((size_t) wd >= ix->watches_cap) {
+    size_t cap = ix->watches_cap > 0 ? 2*ix->watches_cap : 1024;
+    uint32_t* watches = realloc(ix->watches, cap*sizeof(uint32_t));
+
+    if (watches == NULL) {
+      inotify_rm_watch(ix->in_fd, wd);
+      ix->unwatched = true;
+      return;
+    }
+
+    for (size_t i = ix->watches_cap; i < cap; i++) watches[i] = NO_REF;
+
+    ix->watches = watches;
+    ix->watches_cap = cap;
+  }
+
+  ix->watches[wd] = ref;
+#else
+  (void) ref;
+  ix->unwatched = true;
+#endif
+}
+
+
+static void dir_rescan(Index* ix, uint32_t ref);
+
+
+// remove a path (and what's under it)
+static
+void path_remove(Index* ix, uint32_t ref, bool is_dir) {
+  uint32_t dir = NO_REF;
+
+  if (ref & ADDED_BIT) {
+    ix->added[ref & ~ADDED_BIT].removed = true;
+    if (is_dir) dir = ref;
+  }
+  else {
+    ix->removed[ref/64] |= UINT64_C(1) << (ref%64);
+    ix->removed_n++;
+
+    if (is_dir && (dir = built_dir(ix, ref)) != NO_REF) {
+      const IndexDir* d = &ix->dirs[dir];
+
+      for (uint32_t id = d->first; id < d->first + d->n; id++)
+        if (!is_removed(ix, id)) path_remove(ix, id, built_dir(ix, id) != NO_REF);
+    }
+  }
+
+  if (dir == NO_REF) return;
+
+  for (size_t j = 0; j < ix->added_n; j++)
+    if (ix->added[j].parent == dir && !ix->added[j].removed) path_remove(ix, ADDED_BIT | j, ix->added[j].is_dir);
+}
+
+
+// add a path found in directory ref (directories are read too)
+static
+void path_add(Index* ix, uint32_t ref, const char* name, bool is_dir) {
+  const char* dir = dir_path(ix, ref);
+  char path[PATH_MAX];
+  int len = snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] != '\0' ? "/" : "", name);
+
+  if (len >= PATH_MAX || ix->added_n >= ADDED_BIT - 1) return;
+  if (!grow((void**) &ix->added, &ix->added_cap, ix->added_n, sizeof(IndexAdded))) return;
+
+  const char* p = arena_strdup(&ix->added_paths, path, len);
+  if (p == NULL) return;
+
+  ix->added[ix->added_n++] = (IndexAdded) {
+    .path   = p,
+    .parent = ref,
+    .is_dir = is_dir
+  };
+
+  if (!is_dir) return;
+
+  uint32_t added = ADDED_BIT | (ix->added_n - 1);
+
+  watch_add(ix, added);
+  dir_rescan(ix, added);
+}
+
+
+// a name read from a directory
+typedef struct {
+  const char* name;
+  bool        is_dir;
+  bool        seen;                  // (it's in the index)
+} IndexName;
+
+
+static
+const char* base_name(const char* path) {
+  const char* slash = strrchr(path, '/');
+
+  return slash != NULL ? slash + 1 : path;
+}
+
+
+// read directory ref again: names that aren't there anymore are removed, new
+// ones are added
+static
+void dir_rescan(Index* ix, uint32_t ref) {
+  if ((ref & ADDED_BIT) ? ix->added[ref & ~ADDED_BIT].removed :
+      ix->dirs[ref].path != NO_REF && is_removed(ix, ix->dirs[ref].path)) return;
+
+  const char* dir = dir_path(ix, ref);
+  int fd = openat(ix->root_fd, dir[0] != '\0' ? dir : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  struct stat info;
+
+  if (fd < 0) return;
+
+  if (fstat(fd, &info) != 0 || (uint64_t) info.st_dev != ix->dev) {
+    close(fd);
+    return;
+  }
+
+  if (ref & ADDED_BIT) {
+    ix->added[ref & ~ADDED_BIT].mtime_sec = info.st_mtim.tv_sec;
+    ix->added[ref & ~ADDED_BIT].mtime_nsec = info.st_mtim.tv_nsec;
+  }
+  else {
+    ix->dirs[ref].mtime_sec = info.st_mtim.tv_sec;
+    ix->dirs[ref].mtime_nsec = info.st_mtim.tv_nsec;
+  }
+
+  Arena arena = { NULL, NULL };
+  IndexName* names = NULL;
+  size_t names_n = 0, names_cap = 0;
+  uint32_t* slots = NULL;
+  DirReader reader;
+  const char* name;
+  unsigned char type;
+
+  if (dir_reader_open_fd(&reader, fd) != 0) return;
+
+  while (dir_reader_next(&reader, &name, &type)) {
+    if (strcmp(name, ".git") == 0) continue;
+
+    if (type == DT_UNKNOWN) {
+      struct stat entry;
+      if (fstatat(reader.fd, name, &entry, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry.st_mode)) type = DT_DIR;
+    }
+
+    char* copy = arena_strdup(&arena, name, strlen(name));
+
+    if (copy == NULL || !grow((void**) &names, &names_cap, names_n, sizeof(IndexName))) goto done;
+
+    names[names_n++] = (IndexName) { copy, type == DT_DIR, false };
+  }
+
+  // names on disk by hash (position+1 in names)
+  size_t cap = 16;
+  while (cap < 2*names_n) cap *= 2;
+
+  if ((slots = calloc(cap, sizeof(uint32_t))) == NULL) goto done;
+
+  for (size_t i = 0; i < names_n; i++) {
+    size_t s = fnv1a(names[i].name, strlen(names[i].name)) & (cap-1);
+    while (slots[s] != 0) s = (s+1) & (cap-1);
+    slots[s] = i + 1;
+  }
+
+  // what's in the index and isn't on disk anymore goes
+  size_t first = ref & ADDED_BIT ? 0 : ix->dirs[ref].first;
+  size_t last = ref & ADDED_BIT ? 0 : first + ix->dirs[ref].n;
+  size_t added_n = ix->added_n;
+
+  for (size_t k = first; k < last + added_n; k++) {
+    bool built = k < last;
+    const IndexAdded* a = built ? NULL : &ix->added[k - last];
+
+    if (built ? is_removed(ix, k) : (a->parent != ref || a->removed)) continue;
+
+    const char* base = base_name(built ? built_path(ix, k) : a->path);
+    size_t s = fnv1a(base, strlen(base)) & (cap-1);
+
+    while (slots[s] != 0 && strcmp(names[slots[s]-1].name, base) != 0) s = (s+1) & (cap-1);
+
+    if (slots[s] != 0) names[slots[s]-1].seen = true;
+    else if (built) path_remove(ix, k, built_dir(ix, k) != NO_REF);
+    else path_remove(ix, ADDED_BIT | (k - last), a->is_dir);
+  }
+
+  for (size_t i = 0; i < names_n; i++)
+    if (!names[i].seen) path_add(ix, ref, names[i].name, names[i].is_dir);
+
+ done:
+  dir_reader_close(&reader);
+  arena_free(&arena);
+  free(names);
+  free(slots);
+}
+
+
+// read again the directories that changed since they were read (watching them
+// if watch)
+static
+void index_check(Index* ix, bool watch) {
+  size_t dirs_n = ix->header->dirs_n;
+
+  for (size_t k = 0; k < dirs_n + ix->added_n; k++) {
+    if (__atomic_load_n(&ix->stop, __ATOMIC_RELAXED)) return;
+
+    uint32_t ref;
+    int64_t sec, nsec;
+
+    if (k < dirs_n) {
+      if (ix->dirs[k].path != NO_REF && is_removed(ix, ix->dirs[k].path)) continue;
+
+      ref = k;
+      sec = ix->dirs[k].mtime_sec;
+      nsec = ix->dirs[k].mtime_nsec;
+    }
+    else {
+      const IndexAdded* a = &ix->added[k - dirs_n];
+
+      if (!a->is_dir || a->removed) continue;
+
+      // (added ones are watched when they're added)
+      ref = ADDED_BIT | (k - dirs_n);
+      sec = a->mtime_sec;
+      nsec = a->mtime_nsec;
+    }
+
+    if (watch && k < dirs_n) watch_add(ix, ref);
+
+    const char* dir = dir_path(ix, ref);
+    struct stat info;
+
+    if (fstatat(ix->root_fd, dir[0] != '\0' ? dir : ".", &info, AT_SYMLINK_NOFOLLOW) != 0) continue;
+    if (info.st_mtim.tv_sec == sec && info.st_mtim.tv_nsec == nsec) continue;
+
+    pthread_mutex_lock(&ix->lock);
+    dir_rescan(ix, ref);
+    pthread_mutex_unlock(&ix->lock);
+  }
+}
+
+
+// start watching again (all of the directories, with a new inotify instance)
+static
+void index_watch(Index* ix) {
+#ifdef LINUX_INOTIFY
+  if (ix->in_fd >= 0) close(ix->in_fd);
+
+  ix->in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  for (size_t i = 0; i < ix->watches_cap; i++) ix->watches[i] = NO_REF;
+#endif
+
+  ix->unwatched = false;
+
+  index_check(ix, true);
+}
+
+
+// read the events (the directories they happened in are read again)
+static
+void index_events(Index* ix) {
+#ifdef LINUX_INOTIFY
+  struct pollfd pfd = { ix->in_fd, POLLIN, 0 };
+
+  if (ix->in_fd < 0) {
+    usleep(INDEX_POLL_MS*1000);
+    return;
+  }
+
+  if (poll(&pfd, 1, INDEX_POLL_MS) <= 0) return;
+
+  char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  uint32_t refs[1024];
+  size_t refs_n = 0;
+  bool overflow = false;
+  ssize_t len;
+
+  while ((len = read(ix->in_fd, buf, sizeof(buf))) > 0) {
+    for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+      const struct inotify_event* ev = (const struct inotify_event*) p;
+
+      if (ev->mask & IN_Q_OVERFLOW) overflow = true;
+      if (ev->wd < 0 || (size_t) ev->wd >= ix->watches_cap || ix->watches[ev->wd] == NO_REF) continue;
+
+      if (ev->mask & IN_IGNORED) {
+        ix->watches[ev->wd] = NO_REF;
+        continue;
+      }
+
+      uint32_t ref = ix->watches[ev->wd];
+      bool seen = false;
+
+      for (size_t i = 0; i < refs_n && !seen; i++) seen = refs[i] == ref;
+
+      if (!seen && refs_n < 1024) refs[refs_n++] = ref;
+      else if (!seen) overflow = true;
+    }
+  }
+
+  pthread_mutex_lock(&ix->lock);
+  for (size_t i = 0; i < refs_n; i++) dir_rescan(ix, refs[i]);
+  pthread_mutex_unlock(&ix->lock);
+
+  if (overflow) index_check(ix, false);
+#else
+  usleep(INDEX_POLL_MS*1000);
+#endif
+}
+
+
+static
+void* index_run(void* arg) {
+  Index* ix = (Index*) arg;
+
+  // (the index is built if there's none yet, or it's of something else)
+  if (!index_map(ix) && (!index_build(ix) || !index_map(ix))) return NULL;
+
+  index_watch(ix);
+
+  __atomic_store_n(&ix->ready, true, __ATOMIC_RELEASE);
+
+  bool rebuilt = false;
+  size_t failed = 0;                 // (changes when it could not be built)
+  time_t checked = time(NULL);
+
+  while (!__atomic_load_n(&ix->stop, __ATOMIC_RELAXED)) {
+    index_events(ix);
+
+    // (no events come from directories that could not be watched)
+    if (ix->unwatched && time(NULL) - checked >= INDEX_RECHECK_S) {
+      index_check(ix, false);
+      checked = time(NULL);
+    }
+
+    // too many changes: build it again (it's swapped when no query is using it)
+    size_t changed = ix->added_n + ix->removed_n;
+
+    if (!rebuilt && changed > REBUILD_MIN && changed > ix->header->paths_n/8 && changed > 2*failed) {
+      rebuilt = index_build(ix);
+      failed = rebuilt ? 0 : changed;
+    }
+
+    if (rebuilt) {
+      pthread_mutex_lock(&ix->lock);
+
+      if (ix->pins == 0) {
+        index_unmap(ix);
+        rebuilt = false;
+
+        if (!index_map(ix)) {
+          __atomic_store_n(&ix->ready, false, __ATOMIC_RELEASE);
+          pthread_mutex_unlock(&ix->lock);
+          return NULL;
+        }
+      }
+
+      pthread_mutex_unlock(&ix->lock);
+
+      // (what changed while it was built is found by checking the times again)
+      if (!rebuilt) {
+        index_watch(ix);
+        checked = time(NULL);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+bool tree_index_add(const char* root) {
+  char cache[PATH_MAX];
+
+  if (INDEXES_N == INDEX_MAX_ROOTS || !cache_dir(sizeof(cache), cache)) return false;
+
+  Index* ix = calloc(1, sizeof(Index));
+
+  if (ix == NULL) return false;
+
+  struct stat info;
+
+  if (realpath(root, ix->root) == NULL || (ix->root_fd = open(ix->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+    free(ix);
+    return false;
+  }
+
+  fstat(ix->root_fd, &info);
+
+  ix->root_len = strlen(ix->root);
+  ix->dev = info.st_dev;
+  ix->in_fd = -1;
+
+  // one file per root (named by the hash of its path)
+#pragma GCC diagnostic push
+#ifndef __clang__
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#endif
+  snprintf(ix->file, sizeof(ix->file), "%s/index-%016llx", cache,
+           (unsigned long long) fnv1a(ix->root, strlen(ix->root)));
+#pragma GCC diagnostic pop
+
+  pthread_mutex_init(&ix->lock, NULL);
+
+  ix->started = pthread_create(&ix->thread, NULL, index_run, ix) == 0;
+
+  if (!ix->started) {
+    close(ix->root_fd);
+    pthread_mutex_destroy(&ix->lock);
+    free(ix);
+    return false;
+  }
+
+  INDEXES[INDEXES_N++] = ix;
+
+  return true;
+}
+
+
+bool tree_index_begin(const char* dir) {
+  tree_index_end();
+
+  for (size_t i = 0; i < INDEXES_N; i++) {
+    Index* ix = INDEXES[i];
+
+    if (strncmp(dir, ix->root, ix->root_len) != 0 || (dir[ix->root_len] != '/' && dir[ix->root_len] != '\0'))
+      continue;
+
+    // (it's not swapped once pinned)
+    pthread_mutex_lock(&ix->lock);
+    bool ready = __atomic_load_n(&ix->ready, __ATOMIC_ACQUIRE);
+    if (ready) ix->pins++;
+    pthread_mutex_unlock(&ix->lock);
+
+    if (!ready) continue;
+
+    // paths under dir start with this (relative to the root)
+    strlcpy(PINNED_DIR, dir[ix->root_len] == '/' ? dir + ix->root_len + 1 : "", sizeof(PINNED_DIR));
+    PINNED_PREFIX = strlen(PINNED_DIR);
+
+    if (PINNED_PREFIX > 0 && PINNED_PREFIX + 1 < sizeof(PINNED_DIR)) {
+      PINNED_DIR[PINNED_PREFIX++] = '/';
+      PINNED_DIR[PINNED_PREFIX] = '\0';
+    }
+
+    PINNED = ix;
+
+    return true;
+  }
+
+  return false;
+}
+
+
+// check if path contains query (in lower case) ignoring case (the first
+// character is looked for in both cases with strchr, that's way faster than
+// strcasestr)
+static inline
+bool contains(const char* path, const char* query) {
+  char c = query[0], u = toupper((unsigned char) c);
+
+  for (const char* p = path;; p++) {
+    const char* lower = strchr(p, c);
+    const char* upper = u != c ? strchr(p, u) : NULL;
+
+    if (lower == NULL && upper == NULL) return false;
+
+    p = lower == NULL || (upper != NULL && upper < lower) ? upper : lower;
+
+    size_t i = 1;
+    while (query[i] != '\0' && tolower((unsigned char) p[i]) == query[i]) i++;
+
+    if (query[i] == '\0') return true;
+  }
+}
+
+
+// check if path is under the directory searched and matches query
+static inline
+bool query_match(const char* path, const char* query, bool hidden) {
+  if (strncmp(path, PINNED_DIR, PINNED_PREFIX) != 0) return false;
+
+  const char* rel = path + PINNED_PREFIX;
+
+  if (rel[0] == '\0') return false;
+  if (!hidden && (rel[0] == '.' || strstr(rel, "/.") != NULL)) return false;
+
+  return query[0] == '\0' || contains(rel, query);
+}
+
+
+size_t tree_index_query(const char* query, bool hidden, uint32_t** ids, size_t* cap) {
+  Index* ix = PINNED;
+  size_t n = 0;
+
+  if (ix == NULL) return 0;
+
+  char lower[FILTER_QUERY_MAX+1];
+  size_t len = 0;
+
+  for (; query[len] != '\0' && len < FILTER_QUERY_MAX; len++) lower[len] = tolower((unsigned char) query[len]);
+  lower[len] = '\0';
+  query = lower;
+
+  pthread_mutex_lock(&ix->lock);
+
+  size_t paths_n = ix->header->paths_n;
+
+  // paths that have all of the trigrams of the query, starting from the rarest
+  if (len >= 3) {
+    uint32_t tri[FILTER_QUERY_MAX];
+    size_t tri_n = 0;
+
+    for (size_t i = 0; i + 3 <= len; i++) {
+      uint32_t t = trigram(query + i);
+      size_t k = 0;
+
+      while (k < tri_n && tri[k] != t) k++;
+      if (k == tri_n) tri[tri_n++] = t;
+    }
+
+    for (size_t i = 1; i < tri_n; i++)
+      for (size_t k = i; k > 0 && ix->post_offs[tri[k]+1] - ix->post_offs[tri[k]] <
+                                  ix->post_offs[tri[k-1]+1] - ix->post_offs[tri[k-1]]; k--) {
+        uint32_t t = tri[k];
+        tri[k] = tri[k-1];
+        tri[k-1] = t;
+      }
+
+    const uint8_t* p = ix->postings + ix->post_offs[tri[0]];
+    const uint8_t* end = ix->postings + ix->post_offs[tri[0]+1];
+
+    // (a list has at most a path per byte)
+    while ((size_t) (end - p) > *cap) {
+      if (!grow((void**) ids, cap, *cap, sizeof(uint32_t))) goto done;
+    }
+
+    n = posting_decode(p, end, *ids);
+
+    // long lists cost more to go through than checking the paths left
+    for (size_t k = 1; k < tri_n && n > 0; k++) {
+      size_t bytes = ix->post_offs[tri[k]+1] - ix->post_offs[tri[k]];
+
+      if (bytes > 8*n) break;
+
+      n = posting_intersect(ix->postings + ix->post_offs[tri[k]], ix->postings + ix->post_offs[tri[k]+1], *ids, n);
+    }
+
+    size_t m = 0;
+
+    for (size_t i = 0; i < n; i++)
+      if (!is_removed(ix, (*ids)[i]) && query_match(built_path(ix, (*ids)[i]), query, hidden)) (*ids)[m++] = (*ids)[i];
+
+    n = m;
+  }
+  else {
+    // two characters are followed or preceded by some other in any longer path
+    // (so only the paths in those lists are checked)
+    uint64_t* marked = len == 2 ? calloc(paths_n/64 + 1, sizeof(uint64_t)) : NULL;
+
+    if (marked != NULL) {
+      uint32_t a = trigram_char(query[0]), b = trigram_char(query[1]);
+
+      for (uint32_t c = 0; c < 64; c++) {
+        uint32_t t1 = a << 12 | b << 6 | c, t2 = c << 12 | a << 6 | b;
+
+        posting_mark(ix->postings + ix->post_offs[t1], ix->postings + ix->post_offs[t1+1], marked);
+        posting_mark(ix->postings + ix->post_offs[t2], ix->postings + ix->post_offs[t2+1], marked);
+      }
+
+      for (uint32_t id = ix->dirs[0].first; id < ix->dirs[0].first + ix->dirs[0].n; id++)
+        if (strlen(built_path(ix, id)) == 2) marked[id/64] |= UINT64_C(1) << (id%64);
+    }
+
+    for (size_t id = 0; id < paths_n; id++) {
+      if (marked != NULL && marked[id/64] == 0) {
+        id |= 63;
+        continue;
+      }
+
+      if (marked != NULL && !(marked[id/64] >> (id%64) & 1)) continue;
+      if (is_removed(ix, id) || !query_match(built_path(ix, id), query, hidden)) continue;
+
+      if (!grow((void**) ids, cap, n, sizeof(uint32_t))) {
+        free(marked);
+        goto done;
+      }
+
+      (*ids)[n++] = id;
+    }
+
+    free(marked);
+  }
+
+  for (size_t j = 0; j < ix->added_n; j++) {
+    if (ix->added[j].removed || !query_match(ix->added[j].path, query, hidden)) continue;
+
+    if (!grow((void**) ids, cap, n, sizeof(uint32_t))) goto done;
+    (*ids)[n++] = ADDED_BIT | j;
+  }
+
+ done:
+  pthread_mutex_unlock(&ix->lock);
+
+  return n;
+}
+
+
+const char* tree_index_path(uint32_t id) {
+  Index* ix = PINNED;
+
+  if (!(id & ADDED_BIT)) return built_path(ix, id) + PINNED_PREFIX;
+
+  pthread_mutex_lock(&ix->lock);
+  const char* path = ix->added[id & ~ADDED_BIT].path;
+  pthread_mutex_unlock(&ix->lock);
+
+  return path + PINNED_PREFIX;
+}
+
+
+void tree_index_end(void) {
+  if (PINNED == NULL) return;
+
+  pthread_mutex_lock(&PINNED->lock);
+  PINNED->pins--;
+  pthread_mutex_unlock(&PINNED->lock);
+
+  PINNED = NULL;
+}
+
+
+void tree_index_free(void) {
+  tree_index_end();
+
+  for (size_t i = 0; i < INDEXES_N; i++) {
+    Index* ix = INDEXES[i];
+
+    __atomic_store_n(&ix->stop, true, __ATOMIC_RELAXED);
+    pthread_join(ix->thread, NULL);
+
+    index_unmap(ix);
+    arena_free(&ix->added_paths);
+    free(ix->added);
+    free(ix->watches);
+
+    if (ix->in_fd >= 0) close(ix->in_fd);
+    close(ix->root_fd);
+
+    pthread_mutex_destroy(&ix->lock);
+    free(ix);
+  }
+
+  INDEXES_N = 0;
+}
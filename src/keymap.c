@@ -0,0 +1,191 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <keymap.h>
+#include <stdlib.h>
+
+// slots of a new map (it grows when more than 3/4 of them are taken)
+#define KEYMAP_MIN_CAP 64
+
+
+static inline
+size_t slot_of(KMKey key, size_t cap) {
+  // (a murmur3 finalizer: inodes of a directory are often consecutive)
+  uint64_t h = key.ino ^ (key.dev * UINT64_C(0x9e3779b97f4a7c15));
+
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h & (cap-1);
+}
+
+
+static inline
+bool slot_free(const KMSlot* s) {
+  return s->value == NULL && s->key.dev == 0 && s->key.ino == 0;
+}
+
+
+static inline
+bool same_key(KMKey a, KMKey b) {
+  return a.dev == b.dev && a.ino == b.ino;
+}
+
+
+KeyMap* keymap_new(void) {
+  KeyMap* map = (KeyMap*) calloc(1, sizeof(KeyMap));
+
+  if (map == NULL) return NULL;
+
+  map->slots = (KMSlot*) calloc(KEYMAP_MIN_CAP, sizeof(KMSlot));
+
+  if (map->slots == NULL) {
+    free(map);
+    return NULL;
+  }
+
+  map->cap = KEYMAP_MIN_CAP;
+
+  return map;
+}
+
+
+// slot of key (or NULL if it's not there)
+static
+KMSlot* slot_find(const KeyMap* map, KMKey key) {
+  for (size_t s = slot_of(key, map->cap); ; s = (s+1) & (map->cap-1)) {
+    KMSlot* slot = &map->slots[s];
+
+    if (slot_free(slot)) return NULL;
+
+    if (slot->value != NULL && same_key(slot->key, key)) return slot;
+  }
+}
+
+
+// move the keys to cap slots (removed ones are dropped)
+static
+bool rehash(KeyMap* map, size_t cap) {
+  KMSlot* slots = (KMSlot*) calloc(cap, sizeof(KMSlot));
+
+  if (slots == NULL) return false;
+
+  for (size_t i = 0; i < map->cap; i++) {
+    if (map->slots[i].value == NULL) continue;
+
+    size_t s = slot_of(map->slots[i].key, cap);
+    while (!slot_free(&slots[s])) s = (s+1) & (cap-1);
+
+    slots[s] = map->slots[i];
+  }
+
+  free(map->slots);
+
+  map->slots = slots;
+  map->cap = cap;
+  map->used = map->n;
+
+  return true;
+}
+
+
+void keymap_set(KeyMap* map, KMKey key, void* value) {
+  KMSlot* slot = slot_find(map, key);
+
+  if (slot != NULL) {
+    // (removed keys keep their slot, so that the keys after them are still found)
+    if (value == NULL) map->n--;
+
+    slot->value = value;
+    return;
+  }
+
+  // inode 0 is never used
+  if (value == NULL || (key.dev == 0 && key.ino == 0)) return;
+
+  // (it doubles only if it's full of keys, removed ones are just dropped)
+  if (4*(map->used + 1) > 3*map->cap && !rehash(map, 2*map->n + 2 > map->cap ? 2*map->cap : map->cap))
+    return;
+
+  size_t s = slot_of(key, map->cap);
+  while (!slot_free(&map->slots[s])) s = (s+1) & (map->cap-1);
+
+  map->slots[s].key = key;
+  map->slots[s].value = value;
+  map->n++;
+  map->used++;
+}
+
+
+void* keymap_get(const KeyMap* map, KMKey key) {
+  const KMSlot* slot = slot_find(map, key);
+
+  return slot != NULL ? slot->value : NULL;
+}
+
+
+bool keymap_has_key(const KeyMap* map, KMKey key) {
+  return slot_find(map, key) != NULL;
+}
+
+
+void keymap_traverse(KeyMap* map, void* (*f)(KMKey key, void* val, void* ctx), void* ctx) {
+  for (size_t i = 0; i < map->cap; i++) {
+    KMSlot* slot = &map->slots[i];
+
+    if (slot->value == NULL) continue;
+
+    if ((slot->value = f(slot->key, slot->value, ctx)) == NULL) map->n--;
+  }
+}
+
+
+size_t keymap_size(const KeyMap* map) {
+  return map->n;
+}
+
+
+bool keymap_reserve(KeyMap* map, size_t n) {
+  size_t cap = map->cap;
+
+  while (4*(map->n + n) > 3*cap) cap *= 2;
+
+  if (cap == map->cap && 4*(map->used + n) <= 3*cap) return true;
+
+  return rehash(map, cap);
+}
+
+
+void keymap_free(KeyMap* map, bool values) {
+  for (size_t i = 0; values && i < map->cap; i++)
+    if (map->slots[i].value != NULL) free(map->slots[i].value);
+
+  free(map->slots);
+  free(map);
+}
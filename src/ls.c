@@ -24,143 +24,1947 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE
+
 #include "raider.h"
 #include "utils.h"
 
+#include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+// the record returned by getdents64 (glibc < 2.30 does not export it)
+struct linux_dirent64 {
+  uint64_t       d_ino;
+  int64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+#endif
+
+#if defined(__linux__) && defined(STATX_TYPE)
+#define HAS_STATX
+
+// the fields kept in EntryInfo (access and modification times are read on demand)
+#define LS_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_INO | STATX_SIZE | STATX_CTIME)
+#endif
+
+// size of the bulk read buffer (getdents64 fills it with as many records as fit)
+#define DIR_READER_BUF_LEN (128 * 1024)
+
+// orders a listing keeps the sort index of (descending ones read it backwards)
+#define SORT_BASES   "nztvc"
+#define SORT_BASES_N 5
+
+// directory listing (entries never move, SORTED holds their indices in ascending
+// sort order)
+struct Listing {
+  Entry*     entries;                // entries in directory order
+  uint32_t*  sorted;                 // entry indices in sort order
+  size_t     cap;                    // capacity of entries and sorted
+  size_t     entries_n;              // number of entries
+  size_t     sorted_n;               // entries before this position are sorted
+  size_t     pending;                // entries still without metadata
+  size_t     dead_n;                 // entries removed by changes (their name is NULL)
+  size_t     scan_pos;               // entries before this position are loaded
+  size_t     hidden_n;               // entries whose name starts with a dot
+  char       order;                  // order of the sorted entries (0 if not sorted yet)
+  Arena      names;                  // entry names
+  uint32_t*  perms[SORT_BASES_N];    // sort indices of orders used before (NULL if there's none)
+
+  const char** collated;             // collation keys of entries (for orders that sort by them)
+  size_t     collated_n;             // entries before this position have their key
+  size_t     collated_cap;
+  char       collated_kind;          // kind of the keys (0 if there are none)
+  Arena      keys;                   // collation keys
+
+  uint32_t*  view;                   // the sorted entries shown (sorted itself or visible)
+  size_t     view_n;
+  uint32_t*  visible;                // sorted entries without the hidden ones
+  size_t     visible_n;
+  size_t     visible_cap;
+  bool       filtered;               // visible is up to date
+
+  uint32_t*  ranks;                  // position of entries in sorted (and in visible)
+  uint32_t*  visible_ranks;
+  size_t     ranks_cap;
+  bool       ranked;                 // ranks are up to date
+
+  uint32_t*  index;                  // entries by name (open addressing, entry+1 in used slots)
+  size_t     index_cap;              // slots (a power of 2, 0 until a name is looked up)
+  size_t     index_used;             // slots taken (by removed entries too)
+
+  int        dir_fd;                 // the listed directory (to load metadata relative to it)
+  DirReader  reader;                 // the directory being read (huge ones are streamed in)
+  bool       reading;
+  ListSource source;                 // where a virtual listing gets its entries (instead of reader)
+  const char* label;                 // what a virtual listing shows (NULL for directories)
+
+  char*      path;                   // where the directory was listed from
+  uint64_t   dev;                    // directory device and inode (the cache key)
+  uint64_t   ino;
+  int64_t    mtime_sec;              // directory modification time when it was listed
+  int64_t    mtime_nsec;
+
+  int        wd;                     // inotify watch (kept while listed and cached)
+  bool       stale;                  // the directory changed after it was listed
+  Listing*   prev;                   // cache LRU list (most recent first)
+  Listing*   next;
+};
+
+// the current listing
+static Listing* LS = NULL;
+
+// show entries whose name starts with a dot
+static bool LS_SHOW_HIDDEN = false;
+
+// positions of the view shown instead of all of it (while filtering)
+static const uint32_t* LS_FILTER = NULL;
+
+// stat entries in batches through io_uring (when available)
+static bool LS_USE_URING = false;
+
+// number of entries stat'ed in one go when loading metadata
+#define LOAD_BATCH 4096
+
+// number of names read before handing a huge directory over to streaming
+#define LIST_FIRST_CHUNK 65536
+
+// scratch space for merging runs
+static uint32_t* LS_MERGE_BUF = NULL;
+static size_t LS_MERGE_CAP = 0;
+
+// at most this many listings (and this much memory) are kept in the cache
+#define LIST_CACHE_MAX_N     64
+#define LIST_CACHE_MAX_BYTES (128 * 1024 * 1024)
+
+// cached listings (least recently used last)
+static Listing* CACHE_HEAD = NULL;
+static Listing* CACHE_TAIL = NULL;
+
+static ListCacheStats CACHE_STATS;
+
+// listing being read ahead of time (it goes into the cache once it's complete)
+static Listing* PREFETCH = NULL;
+
+// a change to an entry of the current directory
+typedef struct {
+  const char* name;
+  bool        removed;               // removed or renamed away (added or changed otherwise)
+  size_t      seq;                   // order of arrival (the last change of a name wins)
+  uint32_t    entry;                 // the changed entry (NO_ENTRY if it's not listed)
+} Change;
+
+#define NO_ENTRY UINT32_MAX
+
+// changes waiting to be applied (and their names)
+static Change* CHANGES = NULL;
+static size_t CHANGES_N = 0;
+static size_t CHANGES_CAP = 0;
+static Arena CHANGE_NAMES;
+
+#ifdef LINUX_INOTIFY
+// changes that make a listing stale
+#define LIST_CACHE_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+                               IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)
+#endif
+
+
+int dir_reader_open(DirReader* reader, const char* path) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd == -1) return PATH_DOES_NOT_EXISTS;
+
+  return dir_reader_open_fd(reader, fd);
+}
+
+
+int dir_reader_open_fd(DirReader* reader, int fd) {
+#ifdef __linux__
+  reader->fd = fd;
+  reader->buf = malloc(DIR_READER_BUF_LEN);
+
+  if (reader->buf == NULL) {
+    close(reader->fd);
+    return PATH_DOES_NOT_EXISTS;
+  }
+
+  reader->len = 0;
+  reader->off = 0;
+#else
+  reader->dir = fdopendir(fd);
+
+  if (reader->dir == NULL) {
+    close(fd);
+    return PATH_DOES_NOT_EXISTS;
+  }
+
+  reader->fd = fd;
+#endif
+
+  return 0;
+}
+
+
+bool dir_reader_next(DirReader* reader, const char** name, unsigned char* type) {
+#ifdef __linux__
+  for (;;) {
+    if (reader->off >= reader->len) {
+      long nread = syscall(SYS_getdents64, reader->fd, reader->buf, DIR_READER_BUF_LEN);
+
+      if (nread <= 0) return false;
+
+      reader->len = nread;
+      reader->off = 0;
+    }
+
+    struct linux_dirent64* d = (struct linux_dirent64*) (reader->buf + reader->off);
+    reader->off += d->d_reclen;
+
+    if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+      continue;
+
+    *name = d->d_name;
+    *type = d->d_type;
+
+    return true;
+  }
+#else
+  struct dirent* d;
+
+  while ((d = readdir(reader->dir)) != NULL) {
+    if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+      continue;
+
+    *name = d->d_name;
+#ifdef DT_UNKNOWN
+    *type = d->d_type;
+#else
+    *type = 0;
+#endif
+
+    return true;
+  }
+
+  return false;
+#endif
+}
+
+
+void dir_reader_close(DirReader* reader) {
+#ifdef __linux__
+  free(reader->buf);
+  close(reader->fd);
+#else
+  closedir(reader->dir);
+#endif
+}
 
-int list_dir(const char* path) {
-  DIR* dir = opendir(path);
 
-  if (dir == NULL) return PATH_DOES_NOT_EXISTS;
+static
+Listing* listing_new(void) {
+  Listing* l = calloc(1, sizeof(Listing));
 
-  int N = 0;
-  struct dirent* dir_entry;
-  while ((dir_entry = readdir(dir)) != NULL) {
-    if (dir_entry->d_name[0] == '.') continue;
-    N++;
+  if (l == NULL) return NULL;
+
+  l->dir_fd = -1;
+  l->wd = -1;
+
+  return l;
+}
+
+
+// forget the name index (it's built again when it's needed)
+static
+void index_drop(Listing* l) {
+  free(l->index);
+
+  l->index = NULL;
+  l->index_cap = l->index_used = 0;
+}
+
+
+// forget entries and close the directory (buffers are kept for reuse)
+static
+void listing_reset(Listing* l) {
+  if (l->reading && l->source == NULL) dir_reader_close(&l->reader);
+  if (l->dir_fd != -1) close(l->dir_fd);
+
+#ifdef LINUX_INOTIFY
+  if (l->wd != -1) inotify_rm_watch(IN_FD, l->wd);
+#endif
+
+  arena_reset(&l->names);
+  arena_reset(&l->keys);
+
+  for (size_t i = 0; i < SORT_BASES_N; i++) {
+    free(l->perms[i]);
+    l->perms[i] = NULL;
   }
 
-  if (N == 0) {
-    closedir(dir);
-    return N;
+  index_drop(l);
+
+  free(l->path);
+
+  l->path = NULL;
+  l->dir_fd = -1;
+  l->wd = -1;
+  l->stale = false;
+  l->reading = false;
+  l->source = NULL;
+  l->label = NULL;
+  l->entries_n = l->sorted_n = l->pending = l->dead_n = l->scan_pos = l->hidden_n = 0;
+  l->view_n = l->visible_n = 0;
+  l->filtered = false;
+  l->ranked = false;
+  l->order = 0;
+  l->collated_n = 0;
+  l->collated_kind = 0;
+}
+
+
+static
+void listing_free(Listing* l) {
+  if (l == NULL) return;
+
+  listing_reset(l);
+
+  free(l->entries);
+  free(l->sorted);
+  free(l->visible);
+  free(l->ranks);
+  free(l->visible_ranks);
+  free(l->collated);
+  arena_free(&l->names);
+  arena_free(&l->keys);
+  free(l);
+}
+
+
+// memory taken by a listing
+static
+size_t listing_size(const Listing* l) {
+  size_t perms = 0;
+  for (size_t i = 0; i < SORT_BASES_N; i++)
+    if (l->perms[i] != NULL) perms++;
+
+  return sizeof(Listing) + l->cap*(sizeof(Entry) + (1 + perms)*sizeof(uint32_t)) +
+    (l->visible_cap + 2*l->ranks_cap + l->index_cap)*sizeof(uint32_t) + l->collated_cap*sizeof(char*) +
+    arena_size(&l->names) + arena_size(&l->keys);
+}
+
+
+static
+Entry* entries_push(size_t n) {
+  if (n >= LS->cap) {
+    size_t cap = LS->cap == 0 ? 256 : 2*LS->cap;
+    Entry* tmp = realloc(LS->entries, cap*sizeof(Entry));
+
+    if (tmp == NULL) return NULL;
+
+    LS->entries = tmp;
+
+    bool shown = LS->view == LS->sorted;
+    uint32_t* sorted = realloc(LS->sorted, cap*sizeof(uint32_t));
+
+    if (sorted == NULL) return NULL;
+
+    LS->sorted = sorted;
+    LS->cap = cap;
+
+    // the sort index moved (and it may be what is shown)
+    if (shown) LS->view = sorted;
   }
 
-  if (ENTRIES != NULL) free(ENTRIES);
+  memset(&LS->entries[n], 0, sizeof(Entry));
+  LS->sorted[n] = n;
+
+  return &LS->entries[n];
+}
+
+
+#define INDEX_REMOVED UINT32_MAX
+
+static
+void index_insert(uint32_t entry) {
+  const char* name = LS->entries[entry].name;
+  size_t mask = LS->index_cap - 1;
+  size_t i = fnv1a(name, strlen(name)) & mask;
+
+  while (LS->index[i] != 0) i = (i + 1) & mask;
+
+  LS->index[i] = entry + 1;
+  LS->index_used++;
+}
 
-  ENTRIES = calloc(N, sizeof(Entry));
 
-  rewinddir(dir);
+// index entry names (with room for as many again)
+static
+bool index_build(void) {
+  size_t live = LS->entries_n - LS->dead_n;
+  size_t cap = 64;
 
-  int n = 0;
-  char file_name[PATH_MAX];
-  while ((dir_entry = readdir(dir)) != NULL) {
-    if (dir_entry->d_name[0] == '.') continue;
+  while (cap < 2*live) cap *= 2;
 
-    strlcpy(ENTRIES[n].name, dir_entry->d_name, sizeof(ENTRIES[n].name));
+  uint32_t* index = calloc(cap, sizeof(uint32_t));
 
-    path_get_extension(sizeof(ENTRIES[n].ext), ENTRIES[n].ext, dir_entry->d_name);
+  if (index == NULL) return false;
 
-    snprintf(file_name, sizeof(file_name), "%s/%s", path, dir_entry->d_name);
+  free(LS->index);
 
-    struct stat info;
-    if (stat(file_name, &info) == 0) {
-      ENTRIES[n].info = info;
-      ENTRIES[n].type = unknown;
+  LS->index = index;
+  LS->index_cap = cap;
+  LS->index_used = 0;
 
-      if (is_one_of(ENTRIES[n].ext, "txt,org"))
-        ENTRIES[n].type = text;
+  for (size_t i = 0; i < LS->entries_n; i++)
+    if (LS->entries[i].name != NULL) index_insert(i);
+
+  return true;
+}
+
+
+// index a new entry (if there's an index already)
+static
+void index_add(uint32_t entry) {
+  if (LS->index_cap == 0) return;
+
+  // keep it at most 3/4 full: built again (without removed entries) it has the
+  // new entry too
+  if (4*(LS->index_used + 1) > 3*LS->index_cap) {
+    if (!index_build()) index_drop(LS);
+    return;
+  }
+
+  index_insert(entry);
+}
 
-      else if (is_one_of(ENTRIES[n].ext, "pdf,djvu"))
-        ENTRIES[n].type = document;
 
-      else if (is_one_of(ENTRIES[n].ext, "png,jpg,jpeg"))
-        ENTRIES[n].type = image;
+// take an entry that is going out of the index
+static
+void index_remove(uint32_t entry) {
+  if (LS->index_cap == 0) return;
 
-      else if (is_one_of(ENTRIES[n].ext, "avi,mkv,mov,mp4,mpg,wmv,mpeg,webm"))
-        ENTRIES[n].type = video;
+  const char* name = LS->entries[entry].name;
+  size_t mask = LS->index_cap - 1;
 
-      else if (is_one_of(ENTRIES[n].ext, "tar,tgz,zip,rar"))
-        ENTRIES[n].type = archive;
+  for (size_t i = fnv1a(name, strlen(name)) & mask; LS->index[i] != 0; i = (i + 1) & mask)
+    if (LS->index[i] == entry + 1) {
+      LS->index[i] = INDEX_REMOVED;
+      return;
     }
+}
 
-    ENTRIES[n].is_link = lstat(file_name, &info) == 0 && S_ISLNK(info.st_mode);
-    n++;
+
+// entry named name (NO_ENTRY if there's none)
+static
+uint32_t entry_find(const char* name) {
+  if (LS->index_cap == 0 && !index_build()) {
+    // no memory for the index: look for it the slow way
+    for (size_t i = 0; i < LS->entries_n; i++)
+      if (LS->entries[i].name != NULL && strcmp(LS->entries[i].name, name) == 0) return i;
+
+    return NO_ENTRY;
+  }
+
+  size_t mask = LS->index_cap - 1;
+
+  for (size_t i = fnv1a(name, strlen(name)) & mask; LS->index[i] != 0; i = (i + 1) & mask) {
+    uint32_t e = LS->index[i];
+
+    if (e != INDEX_REMOVED && strcmp(LS->entries[e-1].name, name) == 0) return e-1;
+  }
+
+  return NO_ENTRY;
+}
+
+
+static
+bool is_hidden(const char* name) {
+  return name[0] == '.';
+}
+
+
+// descending orders are shown by reading the index of the ascending ones backwards
+static inline
+bool is_reversed(const Listing* l) {
+  return isupper((unsigned char) l->order);
+}
+
+
+static inline
+char base_order(char order) {
+  return (char) tolower((unsigned char) order);
+}
+
+
+// pick the entries shown (the sort index as it is if nothing has to be filtered out)
+static
+void view_select(void) {
+  bool filter = !LS_SHOW_HIDDEN && LS->hidden_n > 0 && LS->filtered;
+
+  LS->view = filter ? LS->visible : LS->sorted;
+  LS->view_n = filter ? LS->visible_n : LS->sorted_n;
+}
+
+
+// note where every entry is (so that they are found without scanning)
+static
+void ranks_update(void) {
+  LS->ranked = false;
+
+  if (LS->cap > LS->ranks_cap) {
+    uint32_t* ranks = realloc(LS->ranks, LS->cap*sizeof(uint32_t));
+
+    if (ranks == NULL) return;
+
+    LS->ranks = ranks;
+
+    uint32_t* visible_ranks = realloc(LS->visible_ranks, LS->cap*sizeof(uint32_t));
+
+    if (visible_ranks == NULL) return;
+
+    LS->visible_ranks = visible_ranks;
+    LS->ranks_cap = LS->cap;
+  }
+
+  for (size_t i = 0; i < LS->sorted_n; i++) LS->ranks[LS->sorted[i]] = i;
+
+  if (LS->filtered)
+    for (size_t i = 0; i < LS->visible_n; i++) LS->visible_ranks[LS->visible[i]] = i;
+
+  LS->ranked = true;
+}
+
+
+// update the entries shown after the sort index changed: hidden ones are filtered
+// out right away (if there are any) so that toggling them is just a matter of
+// picking what is shown
+static
+void view_update(void) {
+  LS->filtered = false;
+
+  if (LS->hidden_n > 0 && LS->sorted_n > LS->visible_cap) {
+    uint32_t* tmp = realloc(LS->visible, LS->sorted_n*sizeof(uint32_t));
+
+    if (tmp != NULL) {
+      LS->visible = tmp;
+      LS->visible_cap = LS->sorted_n;
+    }
+  }
+
+  // (without memory for filtering they are all shown)
+  if (LS->hidden_n > 0 && LS->sorted_n <= LS->visible_cap) {
+    size_t n = 0;
+    for (size_t i = 0; i < LS->sorted_n; i++)
+      if (!is_hidden(LS->entries[LS->sorted[i]].name)) LS->visible[n++] = LS->sorted[i];
+
+    LS->visible_n = n;
+    LS->filtered = true;
+  }
+
+  ranks_update();
+  view_select();
+}
+
+
+// entry shown at pos (NO_ENTRY if there's none)
+static
+uint32_t view_entry(size_t pos) {
+  if (pos >= LS->view_n) return NO_ENTRY;
+
+  return LS->view[is_reversed(LS) ? LS->view_n-1 - pos : pos];
+}
+
+
+// where entry is shown (or def if it isn't)
+static
+size_t view_find(uint32_t entry, size_t def) {
+  size_t i = 0;
+
+  if (LS->ranked && entry < LS->ranks_cap) {
+    // (ranks of entries that aren't shown are whatever they were)
+    i = (LS->view == LS->visible ? LS->visible_ranks : LS->ranks)[entry];
+
+    if (i >= LS->view_n || LS->view[i] != entry) return def;
   }
+  else {
+    while (i < LS->view_n && LS->view[i] != entry) i++;
 
-  closedir(dir);
+    if (i == LS->view_n) return def;
+  }
 
-  return N;
+  return is_reversed(LS) ? LS->view_n-1 - i : i;
 }
 
 
-int by_name_asc(const void* a, const void* b) {
-  const char* a_name = ((const Entry*) a)->name;
-  const char* b_name = ((const Entry*) b)->name;
+// where entry is in the sort index (sorted_n if it isn't)
+static
+size_t sorted_find(uint32_t entry) {
+  size_t i = 0;
+
+  if (LS->ranked && entry < LS->ranks_cap) {
+    i = LS->ranks[entry];
+
+    if (i >= LS->sorted_n || LS->sorted[i] != entry) return LS->sorted_n;
+  }
+  else
+    while (i < LS->sorted_n && LS->sorted[i] != entry) i++;
 
-  return strcmp(a_name, b_name);
+  return i;
 }
 
-int by_name_dsc(const void* a, const void* b) {
-  const char* a_name = ((const Entry*) a)->name;
-  const char* b_name = ((const Entry*) b)->name;
 
-  return -strcmp(a_name, b_name);
+size_t list_dir_find(const char* name, size_t def) {
+  if (LS == NULL) return def;
+
+  uint32_t entry = entry_find(name);
+
+  return entry != NO_ENTRY ? view_find(entry, def) : def;
 }
 
-int by_size_asc(const void* a, const void* b) {
-  int a_size = ((const Entry*) a)->info.st_size;
-  int b_size = ((const Entry*) b)->info.st_size;
 
-  return a_size - b_size;
+Entry* entry_at(size_t pos) {
+  return &LS->entries[view_entry(LS_FILTER != NULL ? LS_FILTER[pos] : pos)];
 }
 
-int by_size_dsc(const void* a, const void* b) {
-  int a_size = ((const Entry*) a)->info.st_size;
-  int b_size = ((const Entry*) b)->info.st_size;
 
-  return b_size - a_size;
+void list_dir_filter(const uint32_t* pos) {
+  LS_FILTER = pos;
 }
 
-int by_ctime_asc(const void* a, const void* b) {
-  int a_ctime = ((const Entry*) a)->info.st_ctim.tv_sec;
-  int b_ctime = ((const Entry*) b)->info.st_ctim.tv_sec;
 
-  return a_ctime - b_ctime;
+static
+void set_info(Entry* entry, const struct stat* info) {
+  entry->info.dev   = info->st_dev;
+  entry->info.ino   = info->st_ino;
+  entry->info.size  = info->st_size;
+  entry->info.ctime = info->st_ctim.tv_sec;
+  entry->info.mode  = info->st_mode;
+  entry->info.uid   = info->st_uid;
+  entry->info.gid   = info->st_gid;
 }
 
-int by_ctime_dsc(const void* a, const void* b) {
-  int a_ctime = ((const Entry*) a)->info.st_ctim.tv_sec;
-  int b_ctime = ((const Entry*) b)->info.st_ctim.tv_sec;
 
-  return b_ctime - a_ctime;
+#ifdef HAS_STATX
+static
+void statx_to_stat(const struct statx* stx, struct stat* info) {
+  memset(info, 0, sizeof(*info));
+
+  info->st_dev          = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  info->st_ino          = stx->stx_ino;
+  info->st_mode         = stx->stx_mode;
+  info->st_uid          = stx->stx_uid;
+  info->st_gid          = stx->stx_gid;
+  info->st_size         = stx->stx_size;
+  info->st_ctim.tv_sec  = stx->stx_ctime.tv_sec;
+  info->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
 }
+#endif
 
 
-void sort_dir(char order) {
-  switch (order) {
-  case 'n':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_name_asc);
-    break;
-  case 'N':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_name_dsc);
-    break;
-  case 'z':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_size_asc);
-    break;
-  case 'Z':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_size_dsc);
-    break;
-  case 't':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_ctime_asc);
-    break;
-  case 'T':
-    qsort(ENTRIES, STATE->files_n, sizeof(ENTRIES[0]), by_ctime_dsc);
-    break;
+static
+int stat_at(int dir_fd, const char* name, bool follow, struct stat* info) {
+#ifdef HAS_STATX
+  struct statx stx;
+
+  if (statx(dir_fd, name, follow ? 0 : AT_SYMLINK_NOFOLLOW, LS_STATX_MASK, &stx) != 0)
+    return -1;
+
+  statx_to_stat(&stx, info);
+
+  return 0;
+#else
+  return fstatat(dir_fd, name, info, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+#endif
+}
+
+
+// (the extension is looked for in the last component: names of virtual listings
+// are paths, longer than the offset could say)
+static
+void entry_set_ext(Entry* entry, size_t len) {
+  const char* base = strrchr(entry->name, '/');
+  size_t from = base != NULL ? (size_t) (base + 1 - entry->name) : 0;
+
+  entry->ext = path_get_extension(entry->name + from, len - from);
+}
+
+
+const char* entry_ext(const Entry* entry) {
+  const char* base = strrchr(entry->name, '/');
+
+  return (base != NULL ? base + 1 : entry->name) + entry->ext;
+}
+
+
+static
+void classify_entry(Entry* entry) {
+  entry->type = get_file_type(entry_ext(entry));
+}
+
+
+// stat entry, returns false if it's gone (only known when the directory didn't tell its type)
+static
+bool stat_entry(int dir_fd, Entry* entry) {
+  struct stat info;
+  bool has_info = false;
+  bool exists = true;
+
+  entry->loaded = true;
+
+#ifdef DT_UNKNOWN
+  if (entry->dtype == DT_LNK) {
+    // d_type already tells it's a link: only the target is needed
+    entry->is_link = true;
+    has_info = stat_at(dir_fd, entry->name, true, &info) == 0;
+  }
+  else if (entry->dtype != DT_UNKNOWN) {
+    // not a link: following or not gives the same result
+    entry->is_link = false;
+    has_info = stat_at(dir_fd, entry->name, false, &info) == 0;
+  }
+  else
+#endif
+  if (stat_at(dir_fd, entry->name, false, &info) == 0) {
+    entry->is_link = S_ISLNK(info.st_mode);
+    has_info = entry->is_link ? stat_at(dir_fd, entry->name, true, &info) == 0 : true;
+  }
+  else exists = false;
+
+  if (!has_info) return exists;
+
+  set_info(entry, &info);
+
+  classify_entry(entry);
+
+  return exists;
+}
+
+
+#ifdef HAS_STATX
+// number of entries stat'ed per io_uring submission
+#define URING_BATCH LOAD_BATCH
+
+static
+int stat_entries_uring(int dir_fd, size_t count, Entry* const list[count]) {
+  const char** names = malloc(URING_BATCH*sizeof(char*));
+  int* flags = malloc(URING_BATCH*sizeof(int));
+  int* res = malloc(URING_BATCH*sizeof(int));
+  size_t* idx = malloc(URING_BATCH*sizeof(size_t));
+  struct statx* bufs = malloc(URING_BATCH*sizeof(struct statx));
+
+  int r = 0;
+
+  if (names == NULL || flags == NULL || res == NULL || idx == NULL || bufs == NULL) {
+    r = -1;
+    goto done;
+  }
+
+  for (size_t start = 0; start < count; start += URING_BATCH) {
+    size_t n = count - start < URING_BATCH ? count - start : URING_BATCH;
+
+    // first round: follow known links, probe everything else without following
+    for (size_t i = 0; i < n; i++) {
+      Entry* entry = list[start+i];
+
+      names[i] = entry->name;
+      flags[i] = entry->dtype == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+      entry->is_link = entry->dtype == DT_LNK;
+    }
+
+    if (uring_statx(dir_fd, n, names, flags, LS_STATX_MASK, bufs, res) < 0) {
+      r = -1;
+      goto done;
+    }
+
+    // second round: follow the links found by the probe
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+      Entry* entry = list[start+i];
+
+      entry->loaded = true;
+
+      if (res[i] == 0 && flags[i] != 0 && S_ISLNK(bufs[i].stx_mode)) {
+        entry->is_link = true;
+        names[m] = entry->name;
+        flags[m] = 0;
+        idx[m++] = i;
+      }
+      else if (res[i] == 0) {
+        struct stat info;
+        statx_to_stat(&bufs[i], &info);
+        set_info(entry, &info);
+        classify_entry(entry);
+      }
+    }
+
+    if (m > 0) {
+      if (uring_statx(dir_fd, m, names, flags, LS_STATX_MASK, bufs, res) < 0) {
+        r = -1;
+        goto done;
+      }
+
+      for (size_t j = 0; j < m; j++)
+        if (res[j] == 0) {
+          Entry* entry = list[start+idx[j]];
+
+          struct stat info;
+          statx_to_stat(&bufs[j], &info);
+          set_info(entry, &info);
+          classify_entry(entry);
+        }
+    }
+  }
+
+ done:
+  free(names);
+  free(flags);
+  free(res);
+  free(idx);
+  free(bufs);
+
+  return r;
+}
+#endif
+
+
+static
+void stat_entries(int dir_fd, size_t n, Entry* const list[n]) {
+  LS->pending -= n;
+
+#ifdef HAS_STATX
+  if (LS_USE_URING && n > 1 && stat_entries_uring(dir_fd, n, list) == 0)
+    return;
+#endif
+
+  for (size_t i = 0; i < n; i++)
+    stat_entry(dir_fd, list[i]);
+}
+
+
+static
+size_t load_entries(const uint32_t* idx, size_t from, size_t to, size_t max) {
+  Entry* list[LOAD_BATCH];
+  size_t n = 0, loaded = 0;
+
+  for (size_t i = from; i < to && loaded < max; i++) {
+    Entry* entry = &LS->entries[idx != NULL ? idx[i] : i];
+
+    if (entry->loaded) continue;
+
+    list[n++] = entry;
+    loaded++;
+
+    if (n == LOAD_BATCH) {
+      stat_entries(LS->dir_fd, n, list);
+      n = 0;
+    }
+  }
+
+  if (n > 0) stat_entries(LS->dir_fd, n, list);
+
+  return loaded;
+}
+
+
+void list_dir_load(size_t from, size_t to) {
+  if (LS == NULL || LS->pending == 0 || LS->dir_fd == -1) return;
+
+  if (to > LS->view_n) to = LS->view_n;
+  if (from >= to) return;
+
+  // filtered rows are anywhere in the view
+  if (LS_FILTER != NULL) {
+    uint32_t idx[256];
+
+    while (from < to) {
+      size_t n = 0;
+
+      for (; from < to && n < 256; from++) idx[n++] = view_entry(LS_FILTER[from]);
+
+      load_entries(idx, 0, n, LS->pending);
+    }
+
+    return;
   }
+
+  // rows of a descending order are at the other end of the index
+  if (is_reversed(LS)) load_entries(LS->view, LS->view_n - to, LS->view_n - from, LS->pending);
+  else load_entries(LS->view, from, to, LS->pending);
+}
+
+
+size_t list_dir_load_pending(size_t max) {
+  if (LS == NULL || LS->pending == 0 || LS->dir_fd == -1) return 0;
+
+  // entries before scan_pos are all loaded (visible ones may be loaded past it)
+  while (LS->scan_pos < LS->entries_n && LS->entries[LS->scan_pos].loaded) LS->scan_pos++;
+
+  LS->scan_pos += load_entries(NULL, LS->scan_pos, LS->entries_n, max);
+
+  return LS->pending;
+}
+
+
+size_t list_dir_pending(void) {
+  return LS != NULL ? LS->pending : 0;
+}
+
+
+void list_dir_use_uring(bool enable) {
+  LS_USE_URING = enable && uring_available();
+}
+
+
+bool list_dir_uses_uring(void) {
+  return LS_USE_URING;
+}
+
+
+size_t list_dir_show_hidden(bool show, size_t* pos) {
+  LS_SHOW_HIDDEN = show;
+
+  if (LS == NULL) return 0;
+
+  // nothing to show or hide
+  if (LS->hidden_n == 0) return LS->view_n;
+
+  uint32_t cur = view_entry(*pos);
+
+  // the pointed entry is going: point to the next one that stays (the previous
+  // one in the index for descending orders)
+  if (!show && cur != NO_ENTRY && is_hidden(LS->entries[cur].name)) {
+    size_t i = sorted_find(cur);
+
+    if (is_reversed(LS)) {
+      while (i > 0 && is_hidden(LS->entries[LS->sorted[i-1]].name)) i--;
+
+      cur = i > 0 ? LS->sorted[i-1] : NO_ENTRY;
+    }
+    else {
+      while (i < LS->sorted_n && is_hidden(LS->entries[LS->sorted[i]].name)) i++;
+
+      cur = i < LS->sorted_n ? LS->sorted[i] : NO_ENTRY;
+    }
+  }
+
+  view_select();
+
+  *pos = cur != NO_ENTRY ? view_find(cur, 0) : (LS->view_n > 0 ? LS->view_n-1 : 0);
+
+  return LS->view_n;
+}
+
+
+bool list_dir_shows_hidden(void) {
+  return LS_SHOW_HIDDEN;
+}
+
+
+static
+size_t read_names(size_t max) {
+  size_t n = 0;
+  const char* name;
+  unsigned char type;
+
+  while (n < max) {
+    if (LS->source != NULL) {
+      int r = LS->source(&name, &type);
+
+      if (r < 0) {
+        LS->source = NULL;
+        LS->reading = false;
+      }
+
+      if (r <= 0) break;
+    }
+    else if (!dir_reader_next(&LS->reader, &name, &type)) {
+      dir_reader_close(&LS->reader);
+      LS->reading = false;
+      break;
+    }
+
+    Entry* entry = entries_push(LS->entries_n);
+
+    if (entry == NULL) break;
+
+    size_t len = strlen(name);
+
+    if ((entry->name = arena_strdup(&LS->names, name, len)) == NULL) break;
+
+    entry_set_ext(entry, len);
+
+    entry->dtype = type;
+
+    if (is_hidden(name)) LS->hidden_n++;
+
+    LS->entries_n++;
+    LS->pending++;
+    n++;
+
+    index_add(LS->entries_n-1);
+  }
+
+  return n;
+}
+
+
+static
+void changes_clear(void) {
+  CHANGES_N = 0;
+  arena_reset(&CHANGE_NAMES);
+}
+
+
+static
+void cache_unlink(Listing* l) {
+  if (l->prev != NULL) l->prev->next = l->next;
+  else CACHE_HEAD = l->next;
+
+  if (l->next != NULL) l->next->prev = l->prev;
+  else CACHE_TAIL = l->prev;
+
+  l->prev = l->next = NULL;
+
+  CACHE_STATS.listings--;
+  CACHE_STATS.bytes -= listing_size(l);
+}
+
+
+// keep a listing for later, returns false if it cannot be cached
+static
+bool cache_put(Listing* l) {
+  // only complete and current listings can be shown again as they are (virtual
+  // ones are not listings of the directory)
+  if (l->reading || l->stale || l->path == NULL || l->label != NULL) return false;
+
+  // trim buffers to size
+  if (l->entries_n > 0 && l->entries_n < l->cap) {
+    Entry* entries = realloc(l->entries, l->entries_n*sizeof(Entry));
+    if (entries != NULL) l->entries = entries;
+
+    uint32_t* sorted = realloc(l->sorted, l->entries_n*sizeof(uint32_t));
+    if (sorted != NULL) l->sorted = sorted;
+
+    if (entries != NULL && sorted != NULL) {
+      l->cap = l->entries_n;
+
+      for (size_t i = 0; i < SORT_BASES_N; i++)
+        if (l->perms[i] != NULL && (sorted = realloc(l->perms[i], l->cap*sizeof(uint32_t))) != NULL)
+          l->perms[i] = sorted;
+    }
+  }
+
+  if (listing_size(l) > LIST_CACHE_MAX_BYTES) return false;
+
+  // an open directory would keep its file system from being unmounted
+  // (it's opened again when the listing is taken back)
+  if (l->dir_fd != -1) {
+    close(l->dir_fd);
+    l->dir_fd = -1;
+  }
+
+  l->prev = NULL;
+  l->next = CACHE_HEAD;
+
+  if (CACHE_HEAD != NULL) CACHE_HEAD->prev = l;
+  else CACHE_TAIL = l;
+
+  CACHE_HEAD = l;
+
+  CACHE_STATS.listings++;
+  CACHE_STATS.bytes += listing_size(l);
+
+  while (CACHE_STATS.listings > LIST_CACHE_MAX_N || CACHE_STATS.bytes > LIST_CACHE_MAX_BYTES) {
+    Listing* old = CACHE_TAIL;
+
+    cache_unlink(old);
+    listing_free(old);
+
+    CACHE_STATS.evicted++;
+  }
+
+  return true;
+}
+
+
+// take the listing of a directory out of the cache
+static
+Listing* cache_take(const struct stat* info) {
+  for (Listing* l = CACHE_HEAD; l != NULL; l = l->next)
+    if (l->dev == (uint64_t) info->st_dev && l->ino == (uint64_t) info->st_ino) {
+      cache_unlink(l);
+      return l;
+    }
+
+  return NULL;
+}
+
+
+void list_cache_invalidate(int wd) {
+  Listing* l = CACHE_HEAD;
+
+  while (l != NULL) {
+    Listing* next = l->next;
+
+    if (wd == -1 || l->wd == wd) {
+      cache_unlink(l);
+      listing_free(l);
+
+      CACHE_STATS.invalidated++;
+    }
+
+    l = next;
+  }
+
+  // the current listing (and the one being read ahead) just won't be cached
+  if (LS != NULL && (wd == -1 || LS->wd == wd)) LS->stale = true;
+  if (PREFETCH != NULL && (wd == -1 || PREFETCH->wd == wd)) PREFETCH->stale = true;
+}
+
+
+bool list_dir_watching(int wd) {
+  return LS != NULL && wd != -1 && LS->wd == wd;
+}
+
+
+void list_cache_stats(ListCacheStats* stats) {
+  *stats = CACHE_STATS;
+  stats->max_bytes = LIST_CACHE_MAX_BYTES;
+}
+
+
+// start reading directory fd (listed from path) into l
+static
+int listing_open(Listing* l, const char* path, int fd, const struct stat* info) {
+  listing_reset(l);
+
+  l->path       = strdup(path);
+  l->dev        = info->st_dev;
+  l->ino        = info->st_ino;
+  l->mtime_sec  = info->st_mtim.tv_sec;
+  l->mtime_nsec = info->st_mtim.tv_nsec;
+
+#ifdef LINUX_INOTIFY
+  // watched before reading, so that no change goes unnoticed, and for as long as
+  // the listing is around (adding a watch walks all the directory entries in the
+  // kernel). Without a watch the listing is validated by modification time only
+  l->wd = inotify_add_watch(IN_FD, path, LIST_CACHE_WATCH_MASK);
+#endif
+
+  if (dir_reader_open_fd(&l->reader, fd) < 0) return PATH_DOES_NOT_EXISTS;
+
+  // keep the directory open for loading metadata later
+  l->dir_fd = fcntl(l->reader.fd, F_DUPFD_CLOEXEC, 0);
+
+  l->reading = true;
+
+  return 0;
+}
+
+
+int list_dir(const char* path) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  struct stat info;
+
+  if (fd == -1) return PATH_DOES_NOT_EXISTS;
+
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return PATH_DOES_NOT_EXISTS;
+  }
+
+  // changes that didn't make it into the listing
+  if (LS != NULL && CHANGES_N > 0) LS->stale = true;
+
+  changes_clear();
+
+  Listing* l = NULL;
+
+  if (LS != NULL && LS->dev == (uint64_t) info.st_dev && LS->ino == (uint64_t) info.st_ino)
+    // the same directory again (a refresh): read it anew
+    l = LS;
+  else {
+    if (LS != NULL && !cache_put(LS)) l = LS;
+
+    LS = NULL;
+
+    Listing* cached = cache_take(&info);
+
+    // being read ahead: carry on reading it as the current listing
+    if (cached == NULL && PREFETCH != NULL && PREFETCH->dev == (uint64_t) info.st_dev && PREFETCH->ino == (uint64_t) info.st_ino) {
+      cached = PREFETCH;
+      PREFETCH = NULL;
+    }
+
+    // a directory modification time that didn't move means no entry was added,
+    // removed or renamed (changes to the entries themselves drop it through the watch)
+    if (cached != NULL && !cached->stale &&
+        cached->mtime_sec == info.st_mtim.tv_sec && cached->mtime_nsec == info.st_mtim.tv_nsec) {
+      listing_free(l);
+
+      free(cached->path);
+      cached->path = strdup(path);
+
+      if (cached->dir_fd != -1) close(cached->dir_fd);
+      cached->dir_fd = fd;
+
+      LS = cached;
+
+      // hidden entries may have been toggled meanwhile
+      view_select();
+
+      CACHE_STATS.hits++;
+
+      return (int) LS->view_n;
+    }
+
+    CACHE_STATS.misses++;
+
+    if (cached != NULL) {
+      // stale: just reuse its buffers
+      CACHE_STATS.invalidated++;
+
+      if (l == NULL) l = cached;
+      else listing_free(cached);
+    }
+  }
+
+  if (l == NULL && (l = listing_new()) == NULL) {
+    close(fd);
+    return PATH_DOES_NOT_EXISTS;
+  }
+
+  LS = l;
+
+  if (listing_open(LS, path, fd, &info) < 0) return PATH_DOES_NOT_EXISTS;
+
+  // only names are read here (metadata is loaded on demand, visible rows first)
+  // and huge directories are read only up to a first chunk, the rest is
+  // streamed in by list_dir_read_more
+  read_names(LIST_FIRST_CHUNK);
+
+  LS->sorted_n = LS->entries_n;
+
+  view_update();
+
+  return (int) LS->view_n;
+}
+
+
+int list_dir_virtual(const char* path, ListSource source, const char* label) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd == -1) return PATH_DOES_NOT_EXISTS;
+
+  if (LS != NULL && CHANGES_N > 0) LS->stale = true;
+
+  changes_clear();
+
+  Listing* l = LS;
+
+  if (l != NULL && cache_put(l)) l = NULL;
+
+  LS = NULL;
+
+  if (l == NULL && (l = listing_new()) == NULL) {
+    close(fd);
+    return PATH_DOES_NOT_EXISTS;
+  }
+
+  LS = l;
+
+  // entries are paths relative to the directory (their metadata is loaded from
+  // it), no device and inode make it match no directory
+  listing_reset(LS);
+
+  LS->path = strdup(path);
+  LS->dev = LS->ino = 0;
+  LS->dir_fd = fd;
+  LS->source = source;
+  LS->label = label;
+  LS->reading = true;
+
+  read_names(LIST_FIRST_CHUNK);
+
+  LS->sorted_n = LS->entries_n;
+
+  view_update();
+
+  return (int) LS->view_n;
+}
+
+
+const char* list_dir_label(void) {
+  return LS != NULL ? LS->label : NULL;
+}
+
+
+bool list_dir_reading(void) {
+  return LS != NULL && LS->reading;
+}
+
+
+void list_dir_free(void) {
+  while (CACHE_HEAD != NULL) {
+    Listing* l = CACHE_HEAD;
+
+    cache_unlink(l);
+    listing_free(l);
+  }
+
+  listing_free(LS);
+  listing_free(PREFETCH);
+  free(LS_MERGE_BUF);
+  free(CHANGES);
+  sort_free();
+  arena_free(&CHANGE_NAMES);
+
+  LS = NULL;
+  PREFETCH = NULL;
+  LS_MERGE_BUF = NULL;
+  LS_MERGE_CAP = 0;
+  CHANGES = NULL;
+  CHANGES_N = CHANGES_CAP = 0;
+}
+
+
+bool sort_needs_info(char order) {
+  return order != 'n' && order != 'N' && sort_key_kind(order) == 0;
+}
+
+
+// compute the collation keys an order needs for the entries that don't have
+// them yet (they are kept with the listing, another kind replaces them)
+static
+bool collated_update(char order) {
+  char kind = sort_key_kind(order);
+
+  if (kind == 0) return true;
+
+  if (kind != LS->collated_kind) {
+    arena_reset(&LS->keys);
+
+    LS->collated_n = 0;
+    LS->collated_kind = kind;
+  }
+
+  if (LS->collated_cap < LS->cap) {
+    const char** tmp = realloc(LS->collated, LS->cap*sizeof(char*));
+
+    if (tmp == NULL) return false;
+
+    LS->collated = tmp;
+    LS->collated_cap = LS->cap;
+  }
+
+  char buf[1024];
+
+  for (; LS->collated_n < LS->entries_n; LS->collated_n++) {
+    const char* name = LS->entries[LS->collated_n].name;
+
+    if (name == NULL) {
+      LS->collated[LS->collated_n] = NULL;
+      continue;
+    }
+
+    size_t len = sort_collation_key(sizeof(buf), buf, name, kind);
+    char* key = arena_alloc(&LS->keys, len + 1);
+
+    if (key == NULL) return false;
+
+    if (len < sizeof(buf)) memcpy(key, buf, len + 1);
+    else sort_collation_key(len + 1, key, name, kind);
+
+    LS->collated[LS->collated_n] = key;
+  }
+
+  return true;
+}
+
+
+// slot of the sort index of an order (-1 if it has none)
+static
+int perm_slot(char order) {
+  const char* base = order != 0 ? strchr(SORT_BASES, base_order(order)) : NULL;
+
+  return base != NULL ? (int) (base - SORT_BASES) : -1;
+}
+
+
+// forget the sort indices of other orders (entries changed)
+static
+void perms_clear(void) {
+  for (size_t i = 0; i < SORT_BASES_N; i++) {
+    free(LS->perms[i]);
+    LS->perms[i] = NULL;
+  }
+}
+
+
+void sort_dir(char order) {
+  // orders by metadata have to wait until it's all there: use names meanwhile
+  if (sort_needs_info(order) && (LS->pending > 0 || LS->reading)) order = 'n';
+
+  // otherwise the index needs sorting anyway
+  bool complete = LS->sorted_n + LS->dead_n == LS->entries_n;
+
+  // already in that order (a listing back from the cache) or in the same one
+  // backwards: it's just read the other way
+  if (complete && LS->order != 0 && base_order(order) == base_order(LS->order)) {
+    LS->order = order;
+    view_select();
+    return;
+  }
+
+  int from = perm_slot(LS->order);
+  int to = perm_slot(order);
+
+  // sorted in that order before (and nothing changed since): swap the indices
+  if (complete && to >= 0 && LS->perms[to] != NULL) {
+    if (from >= 0) LS->perms[from] = LS->sorted;
+    else free(LS->sorted);
+
+    LS->sorted = LS->perms[to];
+    LS->perms[to] = NULL;
+    LS->order = order;
+
+    view_update();
+    return;
+  }
+
+  // keep the index of the current order (the new one is sorted from a copy of it)
+  uint32_t* kept = NULL;
+
+  if (complete && from >= 0 && (kept = malloc(LS->cap*sizeof(uint32_t))) != NULL) {
+    memcpy(kept, LS->sorted, LS->sorted_n*sizeof(uint32_t));
+
+    LS->perms[from] = kept;
+  }
+
+  if (!collated_update(order) || !sort_index(LS->sorted, LS->sorted_n, LS->entries, LS->collated, base_order(order))) {
+    if (kept != NULL) {
+      LS->perms[from] = NULL;
+      free(kept);
+    }
+
+    return;
+  }
+
+  LS->order = order;
+
+  view_update();
+}
+
+
+char sort_dir_order(void) {
+  return LS->order;
+}
+
+
+// merge the sorted runs [0, n) and [n, n+run) of the sort index in place
+static
+bool merge_runs(size_t n, size_t run) {
+  if (n > LS_MERGE_CAP) {
+    uint32_t* tmp = realloc(LS_MERGE_BUF, n*sizeof(uint32_t));
+
+    if (tmp == NULL) return false;
+
+    LS_MERGE_BUF = tmp;
+    LS_MERGE_CAP = n;
+  }
+
+  sort_index_merge(LS->sorted, n, run, LS->entries, LS->collated, base_order(LS->order), LS_MERGE_BUF);
+
+  return true;
+}
+
+
+size_t list_dir_read_more(size_t max, size_t* pos) {
+  if (LS->reading) read_names(max);
+
+  size_t run = LS->entries_n - LS->sorted_n;
+
+  // indices of other orders miss the new entries
+  if (run > 0) perms_clear();
+
+  // merge only runs that are big compared to what is sorted (or the last one):
+  // this keeps the total merging cost linear in the number of entries
+  if (run == 0 || (LS->reading && run < LS->sorted_n/4)) return LS->view_n;
+
+  uint32_t cur = view_entry(*pos);
+
+  if (!collated_update(LS->order) ||
+      !sort_index(&LS->sorted[LS->sorted_n], run, LS->entries, LS->collated, base_order(LS->order)) ||
+      !merge_runs(LS->sorted_n, run))
+    return LS->view_n;
+
+  LS->sorted_n = LS->entries_n;
+
+  view_update();
+
+  if (cur != NO_ENTRY) *pos = view_find(cur, *pos);
+
+  return LS->view_n;
+}
+
+
+// find a listing in the cache
+static
+Listing* cache_find(const struct stat* info) {
+  for (Listing* l = CACHE_HEAD; l != NULL; l = l->next)
+    if (l->dev == (uint64_t) info->st_dev && l->ino == (uint64_t) info->st_ino) return l;
+
+  return NULL;
+}
+
+
+bool list_prefetch(const char* path) {
+  struct stat info;
+
+  if (LS == NULL || stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) return false;
+
+  // already there (or on its way)
+  if (LS->dev == (uint64_t) info.st_dev && LS->ino == (uint64_t) info.st_ino) return false;
+
+  if (PREFETCH != NULL && PREFETCH->dev == (uint64_t) info.st_dev && PREFETCH->ino == (uint64_t) info.st_ino)
+    return true;
+
+  Listing* cached = cache_find(&info);
+
+  if (cached != NULL) {
+    if (cached->mtime_sec == info.st_mtim.tv_sec && cached->mtime_nsec == info.st_mtim.tv_nsec) return false;
+
+    cache_unlink(cached);
+    listing_free(cached);
+
+    CACHE_STATS.invalidated++;
+  }
+
+  list_prefetch_cancel();
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd == -1) return false;
+
+  // it's listed by name (most directories are)
+  if ((PREFETCH = listing_new()) == NULL || listing_open(PREFETCH, path, fd, &info) < 0) {
+    list_prefetch_cancel();
+    return false;
+  }
+
+  PREFETCH->order = 'n';
+
+  return true;
+}
+
+
+bool list_prefetch_step(size_t max) {
+  if (PREFETCH == NULL) return false;
+
+  // the listing functions work on the current listing: the prefetched one takes
+  // its place for a while (reading is just like streaming it in)
+  Listing* current = LS;
+  size_t pos = 0;
+
+  LS = PREFETCH;
+  list_dir_read_more(max, &pos);
+  LS = current;
+
+  if (PREFETCH->reading) return true;
+
+  if (cache_put(PREFETCH)) CACHE_STATS.prefetched++;
+  else listing_free(PREFETCH);
+
+  PREFETCH = NULL;
+
+  return false;
+}
+
+
+bool list_prefetching(void) {
+  return PREFETCH != NULL;
+}
+
+
+void list_prefetch_cancel(void) {
+  listing_free(PREFETCH);
+  PREFETCH = NULL;
+}
+
+
+int list_cache_peek(const char* path, size_t max, const char* names[max]) {
+  struct stat info;
+
+  if (stat(path, &info) != 0) return -1;
+
+  Listing* l = cache_find(&info);
+
+  if (l == NULL || l->mtime_sec != info.st_mtim.tv_sec || l->mtime_nsec != info.st_mtim.tv_nsec) return -1;
+
+  // it's been used: most recent first
+  if (l != CACHE_HEAD) {
+    l->prev->next = l->next;
+
+    if (l->next != NULL) l->next->prev = l->prev;
+    else CACHE_TAIL = l->prev;
+
+    l->prev = NULL;
+    l->next = CACHE_HEAD;
+    CACHE_HEAD->prev = l;
+    CACHE_HEAD = l;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < l->sorted_n && n < max; i++) {
+    const char* name = l->entries[l->sorted[is_reversed(l) ? l->sorted_n-1 - i : i]].name;
+
+    if (LS_SHOW_HIDDEN || !is_hidden(name)) names[n++] = name;
+  }
+
+  return (int) n;
+}
+
+
+void list_dir_change(const char* name, bool removed) {
+  if (LS == NULL) return;
+
+  // a file being written reports the same change over and over
+  if (CHANGES_N > 0 && CHANGES[CHANGES_N-1].removed == removed && strcmp(CHANGES[CHANGES_N-1].name, name) == 0)
+    return;
+
+  if (CHANGES_N == CHANGES_CAP) {
+    size_t cap = CHANGES_CAP == 0 ? 64 : 2*CHANGES_CAP;
+    Change* tmp = realloc(CHANGES, cap*sizeof(Change));
+
+    if (tmp == NULL) {
+      LS->stale = true;
+      return;
+    }
+
+    CHANGES = tmp;
+    CHANGES_CAP = cap;
+  }
+
+  const char* copy = arena_strdup(&CHANGE_NAMES, name, strlen(name));
+
+  if (copy == NULL) {
+    LS->stale = true;
+    return;
+  }
+
+  CHANGES[CHANGES_N].name = copy;
+  CHANGES[CHANGES_N].removed = removed;
+  CHANGES[CHANGES_N].seq = CHANGES_N;
+  CHANGES_N++;
+}
+
+
+size_t list_dir_changes(void) {
+  return CHANGES_N;
+}
+
+
+static
+int by_change_name(const void* a, const void* b) {
+  const Change* a_change = (const Change*) a;
+  const Change* b_change = (const Change*) b;
+
+  int r = strcmp(a_change->name, b_change->name);
+
+  if (r != 0) return r;
+
+  return a_change->seq < b_change->seq ? -1 : a_change->seq > b_change->seq;
+}
+
+
+// drop entry (its slot stays, until there are too many of them)
+static
+void kill_entry(Entry* entry) {
+  if (!entry->loaded) LS->pending--;
+  if (is_hidden(entry->name)) LS->hidden_n--;
+
+  index_remove(entry - LS->entries);
+
+  entry->name = NULL;
+  entry->loaded = true;
+
+  LS->dead_n++;
+}
+
+
+// compact entries when most of them have been removed
+static
+void compact_entries(void) {
+  uint32_t* map = malloc(LS->entries_n*sizeof(uint32_t));
+
+  if (map == NULL) return;
+
+  size_t n = 0, collated_n = 0;
+  for (size_t i = 0; i < LS->entries_n; i++)
+    if (LS->entries[i].name != NULL) {
+      map[i] = n;
+
+      // collation keys move along
+      if (i < LS->collated_n) LS->collated[collated_n++] = LS->collated[i];
+
+      LS->entries[n++] = LS->entries[i];
+    }
+
+  for (size_t i = 0; i < LS->sorted_n; i++)
+    LS->sorted[i] = map[LS->sorted[i]];
+
+  free(map);
+
+  LS->entries_n = n;
+  LS->collated_n = collated_n;
+  LS->dead_n = 0;
+  LS->scan_pos = 0;
+
+  // entries are somewhere else now
+  index_drop(LS);
+
+  view_update();
+}
+
+
+size_t list_dir_apply_changes(size_t* pos) {
+  if (LS == NULL) return 0;
+
+  // the directory is still being read: changes wait for it
+  if (CHANGES_N == 0 || LS->reading) return LS->view_n;
+
+  // only the index of the current order is patched, the others are sorted again if needed
+  perms_clear();
+
+  // the listing is as good as a new one (later changes are caught by the watch)
+  struct stat info;
+
+  if (fstat(LS->dir_fd, &info) == 0) {
+    LS->mtime_sec  = info.st_mtim.tv_sec;
+    LS->mtime_nsec = info.st_mtim.tv_nsec;
+  }
+  else LS->stale = true;
+
+  // keep only the last change of each name
+  qsort(CHANGES, CHANGES_N, sizeof(Change), by_change_name);
+
+  size_t n = 0;
+  for (size_t i = 0; i < CHANGES_N; i++) {
+    if (n > 0 && strcmp(CHANGES[n-1].name, CHANGES[i].name) == 0)
+      CHANGES[n-1] = CHANGES[i];
+    else
+      CHANGES[n++] = CHANGES[i];
+
+  }
+
+  // find the changed entries
+  for (size_t i = 0; i < n; i++) CHANGES[i].entry = entry_find(CHANGES[i].name);
+
+  // entries to stat, entries to (re)insert into the sort index and entries to
+  // take out of it (changed ones move only if they are sorted by metadata)
+  uint32_t* restat = malloc(n*sizeof(uint32_t));
+  uint32_t* run = malloc(n*sizeof(uint32_t));
+  uint8_t* moved = calloc(LS->entries_n/8 + 1, 1);
+
+  if (restat == NULL || run == NULL || moved == NULL) {
+    // no way to patch the listing: read it again next time
+    LS->stale = true;
+    goto done;
+  }
+
+  bool by_info = sort_needs_info(LS->order);
+  size_t stat_n = 0, run_n = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    const Change* change = &CHANGES[i];
+
+    if (change->entry != NO_ENTRY) {
+      Entry* entry = &LS->entries[change->entry];
+
+      if (change->removed) {
+        kill_entry(entry);
+        continue;
+      }
+
+      if (entry->loaded) LS->pending++;
+
+      // it may even be something else by now
+      memset(&entry->info, 0, sizeof(entry->info));
+      entry->dtype = DT_UNKNOWN;
+      entry->is_link = false;
+      entry->loaded = false;
+
+      restat[stat_n++] = change->entry;
+
+      if (by_info) {
+        moved[change->entry/8] |= 1 << (change->entry%8);
+        run[run_n++] = change->entry;
+      }
+    }
+    else if (!change->removed) {
+      Entry* entry = entries_push(LS->entries_n);
+
+      if (entry == NULL) break;
+
+      size_t len = strlen(change->name);
+
+      if ((entry->name = arena_strdup(&LS->names, change->name, len)) == NULL) break;
+
+      entry_set_ext(entry, len);
+      entry->dtype = DT_UNKNOWN;
+
+      if (is_hidden(entry->name)) LS->hidden_n++;
+
+      restat[stat_n++] = LS->entries_n;
+      run[run_n++] = LS->entries_n;
+
+      LS->entries_n++;
+      LS->pending++;
+
+      index_add(LS->entries_n-1);
+    }
+  }
+
+  // changed and new entries are stat'ed right away (they may be gone already)
+  for (size_t i = 0; i < stat_n; i++) {
+    Entry* entry = &LS->entries[restat[i]];
+
+    LS->pending--;
+
+    if (!stat_entry(LS->dir_fd, entry)) kill_entry(entry);
+  }
+
+  // take removed and moving entries out of the sort index (and count the shown
+  // ones that stay before the pointed entry, in case it's gone)
+  uint32_t cur = view_entry(*pos);
+  size_t m = 0, p = 0, shown = 0;
+
+  for (size_t i = 0; i < LS->sorted_n; i++) {
+    uint32_t e = LS->sorted[i];
+
+    if (e == cur) p = shown;
+
+    if (LS->entries[e].name == NULL || moved[e/8] & (1 << (e%8))) continue;
+
+    LS->sorted[m++] = e;
+
+    if (LS_SHOW_HIDDEN || !is_hidden(LS->entries[e].name)) shown++;
+  }
+
+  // put them back in order
+  size_t k = 0;
+  for (size_t i = 0; i < run_n; i++)
+    if (LS->entries[run[i]].name != NULL) LS->sorted[m + k++] = run[i];
+
+  if (!collated_update(LS->order) || !sort_index(&LS->sorted[m], k, LS->entries, LS->collated, base_order(LS->order)) ||
+      !merge_runs(m, k)) {
+    // no memory to sort them in: they stay at the end until it's read again
+    LS->stale = true;
+  }
+
+  LS->sorted_n = m + k;
+
+  view_update();
+
+  // follow the pointed entry, if it's gone point to the one that took its place
+  // (the one before it in the index for descending orders)
+  if (is_reversed(LS)) p = LS->view_n > p ? LS->view_n - p : 0;
+
+  if (cur != NO_ENTRY && LS->entries[cur].name != NULL) p = view_find(cur, p);
+
+  *pos = p < LS->view_n ? p : (LS->view_n > 0 ? LS->view_n-1 : 0);
+
+  if (LS->dead_n > LS->entries_n/2) compact_entries();
+
+ done:
+  free(restat);
+  free(run);
+  free(moved);
+
+  changes_clear();
+
+  return LS->view_n;
+}
+
+
+static
+int by_name_ptr(const void* a, const void* b) {
+  return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+
+bool list_dir_rescan(void (*on_change)(const char*, bool)) {
+  if (LS == NULL || LS->reading || LS->dir_fd == -1) return false;
+
+  DirReader reader;
+  int fd = openat(LS->dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd == -1 || dir_reader_open_fd(&reader, fd) < 0) return false;
+
+  // names in the directory now and names in the listing, both sorted
+  Arena names = { NULL, NULL };
+  const char** found = NULL;
+  size_t found_n = 0, found_cap = 0;
+
+  const char** listed = malloc((LS->entries_n - LS->dead_n + 1)*sizeof(char*));
+  size_t listed_n = 0;
+
+  bool ok = listed != NULL;
+
+  const char* name;
+  unsigned char type;
+
+  while (ok && dir_reader_next(&reader, &name, &type)) {
+    if (found_n == found_cap) {
+      size_t cap = found_cap == 0 ? 256 : 2*found_cap;
+      const char** tmp = realloc(found, cap*sizeof(char*));
+
+      if (tmp == NULL) {
+        ok = false;
+        break;
+      }
+
+      found = tmp;
+      found_cap = cap;
+    }
+
+    if ((found[found_n++] = arena_strdup(&names, name, strlen(name))) == NULL) ok = false;
+  }
+
+  dir_reader_close(&reader);
+
+  if (ok) {
+    for (size_t i = 0; i < LS->entries_n; i++)
+      if (LS->entries[i].name != NULL) listed[listed_n++] = LS->entries[i].name;
+
+    qsort(found, found_n, sizeof(char*), by_name_ptr);
+    qsort(listed, listed_n, sizeof(char*), by_name_ptr);
+
+    size_t i = 0, j = 0;
+    while (i < found_n || j < listed_n) {
+      int r = i == found_n ? 1 : j == listed_n ? -1 : strcmp(found[i], listed[j]);
+
+      if      (r < 0) on_change(found[i++], false);
+      else if (r > 0) on_change(listed[j++], true);
+      else { i++; j++; }
+    }
+  }
+
+  free(found);
+  free(listed);
+  arena_free(&names);
+
+  return ok;
 }
@@ -0,0 +1,263 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include "raider.h"
+
+#ifdef HAS_IO_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// number of submission queue entries (the completion queue is twice as big)
+#define URING_ENTRIES 256
+
+typedef struct {
+  int       fd;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+
+  void*     sq_ptr;
+  size_t    sq_len;
+  void*     cq_ptr;
+  size_t    cq_len;
+  size_t    sqes_len;
+
+  unsigned  sq_entries;
+} Ring;
+
+// the ring is created on first use and kept open
+static Ring RING;
+
+// 0: not tried yet, 1: ready, -1: unavailable
+static int RING_STATUS = 0;
+
+
+static
+bool uring_has_statx(int fd) {
+  size_t len = sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe = calloc(1, len);
+
+  if (probe == NULL) return false;
+
+  bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+    && probe->last_op >= IORING_OP_STATX
+    && probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED;
+
+  free(probe);
+
+  return ok;
+}
+
+
+static
+bool uring_init(void) {
+  if (RING_STATUS != 0) return RING_STATUS == 1;
+
+  RING_STATUS = -1;
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  RING.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+
+  if (RING.fd < 0) return false;
+
+  if (!uring_has_statx(RING.fd)) goto fail;
+
+  RING.sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  RING.cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  RING.sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+
+  RING.sq_ptr = mmap(NULL, RING.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING.fd, IORING_OFF_SQ_RING);
+  if (RING.sq_ptr == MAP_FAILED) goto fail;
+
+  RING.cq_ptr = mmap(NULL, RING.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING.fd, IORING_OFF_CQ_RING);
+  if (RING.cq_ptr == MAP_FAILED) {
+    munmap(RING.sq_ptr, RING.sq_len);
+    goto fail;
+  }
+
+  RING.sqes = mmap(NULL, RING.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RING.fd, IORING_OFF_SQES);
+  if (RING.sqes == MAP_FAILED) {
+    munmap(RING.sq_ptr, RING.sq_len);
+    munmap(RING.cq_ptr, RING.cq_len);
+    goto fail;
+  }
+
+  RING.sq_head  = (unsigned*) ((char*) RING.sq_ptr + p.sq_off.head);
+  RING.sq_tail  = (unsigned*) ((char*) RING.sq_ptr + p.sq_off.tail);
+  RING.sq_mask  = (unsigned*) ((char*) RING.sq_ptr + p.sq_off.ring_mask);
+  RING.sq_array = (unsigned*) ((char*) RING.sq_ptr + p.sq_off.array);
+
+  RING.cq_head  = (unsigned*) ((char*) RING.cq_ptr + p.cq_off.head);
+  RING.cq_tail  = (unsigned*) ((char*) RING.cq_ptr + p.cq_off.tail);
+  RING.cq_mask  = (unsigned*) ((char*) RING.cq_ptr + p.cq_off.ring_mask);
+  RING.cqes     = (struct io_uring_cqe*) ((char*) RING.cq_ptr + p.cq_off.cqes);
+
+  RING.sq_entries = p.sq_entries;
+
+  RING_STATUS = 1;
+
+  return true;
+
+ fail:
+  close(RING.fd);
+  return false;
+}
+
+
+bool uring_available(void) {
+  return uring_init();
+}
+
+
+// give up on the ring (for good)
+static
+void uring_close(void) {
+  munmap(RING.sqes, RING.sqes_len);
+  munmap(RING.cq_ptr, RING.cq_len);
+  munmap(RING.sq_ptr, RING.sq_len);
+  close(RING.fd);
+
+  RING_STATUS = -1;
+}
+
+
+// collect completions (they come back in any order), returns how many
+static
+size_t uring_reap(size_t n, int res[n]) {
+  unsigned cq_head = *RING.cq_head;
+  unsigned cq_tail = __atomic_load_n(RING.cq_tail, __ATOMIC_ACQUIRE);
+  size_t reaped = 0;
+
+  while (cq_head != cq_tail) {
+    struct io_uring_cqe* cqe = &RING.cqes[cq_head & *RING.cq_mask];
+
+    if (cqe->user_data < n) res[cqe->user_data] = cqe->res;
+
+    cq_head++;
+    reaped++;
+  }
+
+  __atomic_store_n(RING.cq_head, cq_head, __ATOMIC_RELEASE);
+
+  return reaped;
+}
+
+
+// wait for the requests the kernel took (they write to bufs), the ones it didn't
+// are taken back: no completion is left for later calls, returns -1
+static
+int uring_abort(size_t n, int res[n], size_t submitted, size_t completed) {
+  unsigned head = __atomic_load_n(RING.sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *RING.sq_tail;
+
+  __atomic_store_n(RING.sq_tail, head, __ATOMIC_RELEASE);
+  submitted -= tail - head;
+
+  completed += uring_reap(n, res);
+
+  while (completed < submitted) {
+    if (syscall(__NR_io_uring_enter, RING.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      uring_close();
+      break;
+    }
+
+    completed += uring_reap(n, res);
+  }
+
+  return -1;
+}
+
+
+int uring_statx(int dir_fd, size_t n, const char* const names[n], const int flags[n],
+                unsigned int mask, struct statx* bufs, int res[n]) {
+  if (!uring_init()) return -1;
+
+  size_t submitted = 0, completed = 0;
+
+  while (completed < n) {
+    // queue as many requests as the ring (and the completion queue) can take
+    unsigned tail = *RING.sq_tail;
+    unsigned head = __atomic_load_n(RING.sq_head, __ATOMIC_ACQUIRE);
+
+    while (submitted < n && tail - head < RING.sq_entries && submitted - completed < 2*RING.sq_entries) {
+      unsigned idx = tail & *RING.sq_mask;
+      struct io_uring_sqe* sqe = &RING.sqes[idx];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode      = IORING_OP_STATX;
+      sqe->fd          = dir_fd;
+      sqe->addr        = (uint64_t) (uintptr_t) names[submitted];
+      sqe->len         = mask;
+      sqe->off         = (uint64_t) (uintptr_t) &bufs[submitted];
+      sqe->statx_flags = flags[submitted];
+      sqe->user_data   = submitted;
+
+      RING.sq_array[idx] = idx;
+
+      tail++;
+      submitted++;
+    }
+
+    __atomic_store_n(RING.sq_tail, tail, __ATOMIC_RELEASE);
+
+    // requests the kernel didn't take last time are still between head and tail
+    if (syscall(__NR_io_uring_enter, RING.fd, tail - head, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+        && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return uring_abort(n, res, submitted, completed);
+
+    completed += uring_reap(n, res);
+  }
+
+  return 0;
+}
+#else
+  bool uring_available(void) { return false; }
+
+  int uring_statx(int dir_fd __attribute__((unused)), size_t n,
+                  const char* const names[n] __attribute__((unused)), const int flags[n] __attribute__((unused)),
+                  unsigned int mask __attribute__((unused)), struct statx* bufs __attribute__((unused)),
+                  int res[n] __attribute__((unused))) { return -1; }
+#endif
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -39,7 +40,7 @@
 #include <sys/sysmacros.h>
 #endif
 
-const char FILE_TYPES[file_type_num][10] = {"unknown", "text", "document", "image", "video", "archive"};
+const char FILE_TYPES[file_type_num][10] = {"unknown", "text", "code", "document", "image", "video", "audio", "archive"};
 
 const char W3MIMAGEDISPLAY_LOCATIONS[6][64] = {"/usr/lib/w3m/w3mimgdisplay", "/usr/libexec/w3m/w3mimgdisplay", "/usr/lib64/w3m/w3mimgdisplay", "/usr/libexec64/w3m/w3mimgdisplay", "/usr/local/libexec/w3m/w3mimgdisplay", "/usr/pkg/libexec/w3m/w3mimgdisplay"};
 
@@ -304,13 +305,13 @@ void previewer_document_text(const void* preview, WINDOW* win, const Entry* entr
     return;
   }
 
-  if (strcmp(entry->ext, "pdf") == 0 &&  ((const Preview*) preview)->has_pdftotext) {
+  if (strcasecmp(entry_ext(entry), "pdf") == 0 &&  ((const Preview*) preview)->has_pdftotext) {
     char cmd[PATH_MAX+64];
     snprintf(cmd, sizeof(cmd), "2>/dev/null pdftotext -f 0 -l 0  '%s' -", path);
 
     if (display_command_output(win, cmd, false) != 0) preview_file_info(win, entry);
   }
-  else if (strcmp(entry->ext, "djvu") == 0 && ((const Preview*) preview)->has_djvutxt) {
+  else if (strcasecmp(entry_ext(entry), "djvu") == 0 && ((const Preview*) preview)->has_djvutxt) {
     char cmd[PATH_MAX+64];
     snprintf(cmd, sizeof(cmd), "2>/dev/null djvutxt --page=0 '%s'", path);
 
@@ -388,8 +389,7 @@ void thumbnailer_document_sixel(const void* preview __attribute__((unused)), con
 void preview_init(Preview* preview) {
   // create cache directory
   char buf[PATH_MAX];
-  snprintf(buf, sizeof(buf), "%s/.cache/raider", getenv("HOME"));
-  mkdir(buf, S_IRWXU|S_IXUSR);
+  cache_dir(sizeof(buf), buf);
 
   // get X11
   preview->has_x11 = false;
@@ -421,12 +421,15 @@ void preview_init(Preview* preview) {
   }
 
   preview->previewer[text] = preview_text_file;
+  preview->previewer[code] = preview_text_file;
 
   if (preview->has_pdftotext || preview->has_djvutxt)
     preview->previewer[document] = previewer_document_text;
 
-  if (preview->has_mediainfo)
+  if (preview->has_mediainfo) {
     preview->previewer[video] = previewer_video_text;
+    preview->previewer[audio] = previewer_video_text;
+  }
 }
 
 
@@ -531,8 +534,8 @@ void preview_file(const Preview* preview, WINDOW* win, const Entry* entry) {
              sizeof(cache_path),
              "%s/.cache/raider/%i-%llu.%s",
              getenv("HOME"),
-             (int) entry->info.st_dev,
-             (unsigned long long int) entry->info.st_ino,
+             (int) entry->info.dev,
+             (unsigned long long int) entry->info.ino,
              preview->mode == sixel ? "six" : "jpg");
 
     if (path_exists(cache_path)) {
@@ -571,6 +574,20 @@ void preview_directory(const Preview* preview, WINDOW* win, const Entry* dir_ent
     return;
   }
 
+  int lines, cols;
+  getmaxyx(win, lines, cols);
+
+  // visited or read ahead already: no need to read it again
+  const char* names[lines];
+  int n = list_cache_peek(dir_path, lines, names);
+
+  if (n >= 0) {
+    for (int i = 0; i < n; i++)
+      mvwaddnstr(WRGT, i, 1, names[i], cols-1);
+
+    return;
+  }
+
   DIR* dir = opendir(dir_path);
 
   if (dir == NULL) {
@@ -579,13 +596,14 @@ void preview_directory(const Preview* preview, WINDOW* win, const Entry* dir_ent
     return;
   }
 
-  int lines, cols;
-  getmaxyx(win, lines, cols);
-
-  int n = 0;
+  n = 0;
   struct dirent* entry;
+  bool show_hidden = list_dir_shows_hidden();
+
   while ((entry = readdir(dir)) != NULL && n < lines) {
-    if (entry->d_name[0] == '.') continue;
+    if (entry->d_name[0] == '.' && (!show_hidden || entry->d_name[1] == '\0' ||
+                                    (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+      continue;
     mvwaddnstr(WRGT, n, 1, entry->d_name, cols-1);
     n++;
   }
@@ -605,19 +623,24 @@ void preview_file_info(WINDOW* win, const Entry* entry) {
   struct passwd* pws;
   struct group* grp;
 
-  pws = getpwuid(entry->info.st_uid);
-  grp = getgrgid(entry->info.st_gid);
+  pws = getpwuid(entry->info.uid);
+  grp = getgrgid(entry->info.gid);
 
   get_mode_line(mode, entry);
   get_size_line(sizeof(size), size, entry);
-  get_time_line(sizeof(ctime), ctime, entry->info.st_ctim.tv_sec);
-  get_time_line(sizeof(mtime), mtime, entry->info.st_mtim.tv_sec);
-  get_time_line(sizeof(atime), atime, entry->info.st_atim.tv_sec);
+  get_time_line(sizeof(ctime), ctime, entry->info.ctime);
+
+  // access and modification times are not kept in the listing
+  char file_path[PATH_MAX];
+  struct stat info;
+  if (path_get_full(file_path, entry, false) == 0 && stat(file_path, &info) == 0) {
+    get_time_line(sizeof(mtime), mtime, info.st_mtim.tv_sec);
+    get_time_line(sizeof(atime), atime, info.st_atim.tv_sec);
+  }
 
   if (entry->is_link) {
     mvwprintw(win, 0, 1, "  Link: %s", entry->name);
 
-    char file_path[PATH_MAX];
     char link_path[PATH_MAX];
     if (path_get_full(file_path, entry, false) == 0) {
       size_t l = readlink(file_path, link_path, sizeof(link_path));
@@ -625,19 +648,19 @@ void preview_file_info(WINDOW* win, const Entry* entry) {
       mvwprintw(win, 1, 1, "        -> %s", link_path);
     }
   }
-  else if (S_ISDIR(entry->info.st_mode))
+  else if (S_ISDIR(entry->info.mode))
     mvwprintw(win, 0, 1, "   Dir: %s", entry->name);
-  else if (S_ISREG(entry->info.st_mode))
+  else if (S_ISREG(entry->info.mode))
     mvwprintw(win, 0, 1, "  File: %s", entry->name);
 
   mvwprintw(win, 2, 1,  "  Size: %s", size);
-  mvwprintw(win, 2, 22, "FileType: %s (%s)", FILE_TYPES[entry->type], entry->ext);
+  mvwprintw(win, 2, 22, "FileType: %s (%s)", FILE_TYPES[entry->type], entry_ext(entry));
 
   mvwprintw(win, 3, 1,  "  Mode: (%s)", mode);
-  mvwprintw(win, 3, 22, "Uid: (%i/%s) Gid: (%i/%s)", entry->info.st_uid, pws->pw_name, entry->info.st_gid, grp->gr_name);
+  mvwprintw(win, 3, 22, "Uid: (%i/%s) Gid: (%i/%s)", entry->info.uid, pws->pw_name, entry->info.gid, grp->gr_name);
 
-  mvwprintw(win, 4, 1,  "Device: %i,%i", major(entry->info.st_dev), minor(entry->info.st_dev));
-  mvwprintw(win, 4, 22, "Inode: %lli", (unsigned long long int) entry->info.st_ino);
+  mvwprintw(win, 4, 1,  "Device: %i,%i", major(entry->info.dev), minor(entry->info.dev));
+  mvwprintw(win, 4, 22, "Inode: %lli", (unsigned long long int) entry->info.ino);
 
   mvwprintw(win, 5, 1,  "Access: %s", atime);
 
@@ -0,0 +1,382 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include "raider.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if defined(__linux__) && defined(STATX_TYPE)
+#define HAS_STATX
+#endif
+
+// most terms in a query
+#define QUERY_TERMS 16
+
+typedef enum { field_name, field_type, field_depth, field_size, field_mtime, field_ctime,
+               field_user, field_group, field_mode } QueryField;
+
+typedef enum { op_eq, op_ne, op_lt, op_le, op_gt, op_ge, op_all } QueryOp;
+
+// entry kinds for type= (file types guessed from the extension come after them)
+typedef enum { kind_file = file_type_num, kind_dir, kind_link } QueryKind;
+
+typedef struct {
+  QueryField field;
+  QueryOp    op;
+  int64_t    value;                  // (times are how long ago, in seconds)
+  char       pattern[NAME_MAX+1];    // (name= glob)
+} QueryTerm;
+
+// terms that need no metadata come first (entries that fail them aren't stat'ed)
+struct Query {
+  QueryTerm terms[QUERY_TERMS];
+  size_t    n;
+  size_t    cheap;                   // terms before this one need no metadata
+  unsigned  mask;                    // statx fields the other ones need
+  size_t    depth;                   // deepest level looked at (SIZE_MAX for all of them)
+  int64_t   now;
+};
+
+static const char* FIELDS[] = { "name", "type", "depth", "size", "mtime", "ctime", "user", "group", "mode" };
+static const char* OPS[] = { "=", "!=", "<", "<=", ">", ">=", "&" };
+
+
+static
+bool compare(int64_t a, QueryOp op, int64_t b) {
+  switch (op) {
+  case op_eq: return a == b;
+  case op_ne: return a != b;
+  case op_lt: return a < b;
+  case op_le: return a <= b;
+  case op_gt: return a > b;
+  case op_ge: return a >= b;
+  case op_all: return (a & b) == b;
+  }
+
+  return false;
+}
+
+
+// number with an optional unit (units are powers of 1024 for sizes, time spans otherwise)
+static
+bool parse_number(const char* s, bool is_time, int64_t* value) {
+  char* end;
+  double v = strtod(s, &end);
+
+  if (end == s || v < 0) return false;
+
+  static const char size_units[] = "kmgt";
+  static const char time_units[] = "smhdwy";
+  static const double time_secs[] = { 1, 60, 3600, 86400, 7*86400, 365*86400 };
+
+  if (*end != '\0') {
+    const char* p = strchr(is_time ? time_units : size_units, tolower((unsigned char) *end));
+
+    // (sizes may end in b, like 4kb)
+    bool last = end[1] == '\0' || (!is_time && tolower((unsigned char) end[1]) == 'b' && end[2] == '\0');
+
+    if (p == NULL || !last) return false;
+
+    v *= is_time ? time_secs[p - time_units] : (double) (UINT64_C(1) << (10*(p - size_units + 1)));
+  }
+
+  *value = (int64_t) v;
+
+  return true;
+}
+
+
+static
+bool parse_term(const char* s, QueryTerm* t, char* err, size_t err_len) {
+  size_t f = 0, flen = 0;
+
+  for (; f < sizeof(FIELDS)/sizeof(*FIELDS); f++) {
+    flen = strlen(FIELDS[f]);
+    if (strncmp(s, FIELDS[f], flen) == 0 && strchr("=!<>&", s[flen]) != NULL) break;
+  }
+
+  if (f == sizeof(FIELDS)/sizeof(*FIELDS)) {
+    snprintf(err, err_len, "unknown term %s", s);
+    return false;
+  }
+
+  // (the longest operator that matches)
+  size_t o = 0, olen = 0;
+
+  for (size_t k = 0; k < sizeof(OPS)/sizeof(*OPS); k++)
+    if (strncmp(s + flen, OPS[k], strlen(OPS[k])) == 0 && strlen(OPS[k]) > olen) {
+      o = k;
+      olen = strlen(OPS[k]);
+    }
+
+  const char* v = s + flen + olen;
+
+  t->field = (QueryField) f;
+  t->op = (QueryOp) o;
+  t->pattern[0] = '\0';
+
+  bool ok = true;
+  bool equality = t->op == op_eq || t->op == op_ne;
+
+  switch (t->field) {
+  case field_name:
+    ok = equality && strlcpy(t->pattern, v, sizeof(t->pattern)) < sizeof(t->pattern);
+    break;
+
+  case field_type:
+    ok = false;
+
+    for (int k = 1; k < file_type_num && !ok; k++)
+      if (strcmp(v, FILE_TYPES[k]) == 0) t->value = k, ok = true;
+
+    if (strcmp(v, "file") == 0) t->value = kind_file, ok = true;
+    if (strcmp(v, "dir") == 0) t->value = kind_dir, ok = true;
+    if (strcmp(v, "link") == 0) t->value = kind_link, ok = true;
+
+    ok = ok && equality;
+    break;
+
+  case field_depth:
+  case field_size:
+    ok = t->op != op_all && parse_number(v, false, &t->value);
+    break;
+
+  case field_mtime:
+  case field_ctime:
+    ok = t->op != op_all && parse_number(v, true, &t->value);
+    break;
+
+  case field_user:
+  case field_group: {
+    char* end;
+    long id = strtol(v, &end, 10);
+    struct passwd* pw;
+    struct group* gr;
+
+    if (end != v && *end == '\0') t->value = id;
+    else if (t->field == field_user && (pw = getpwnam(v)) != NULL) t->value = pw->pw_uid;
+    else if (t->field == field_group && (gr = getgrnam(v)) != NULL) t->value = gr->gr_gid;
+    else ok = false;
+
+    ok = ok && equality;
+    break;
+  }
+
+  case field_mode: {
+    char* end;
+    t->value = strtol(v, &end, 8);
+    ok = end != v && *end == '\0' && (equality || t->op == op_all);
+    break;
+  }
+  }
+
+  if (!ok) snprintf(err, err_len, "invalid term %s", s);
+
+  return ok;
+}
+
+
+Query* query_compile(const char* text, char* err, size_t err_len) {
+  Query* q = calloc(1, sizeof(Query));
+
+  if (q == NULL) {
+    snprintf(err, err_len, "no memory for the query");
+    return NULL;
+  }
+
+  q->depth = SIZE_MAX;
+  q->now = time(NULL);
+
+  char buf[FILTER_QUERY_MAX+1];
+  strlcpy(buf, text, sizeof(buf));
+
+  QueryTerm costly[QUERY_TERMS];
+  size_t costly_n = 0;
+
+  for (char* s = strtok(buf, " "); s != NULL; s = strtok(NULL, " ")) {
+    QueryTerm t;
+
+    if (q->n + costly_n == QUERY_TERMS) {
+      snprintf(err, err_len, "too many terms");
+      free(q);
+      return NULL;
+    }
+
+    if (!parse_term(s, &t, err, err_len)) {
+      free(q);
+      return NULL;
+    }
+
+    // the walk goes no deeper than the depth terms allow
+    if (t.field == field_depth) {
+      size_t d = t.op == op_lt ? (t.value > 0 ? (size_t) t.value - 1 : 0) :
+                 t.op == op_le || t.op == op_eq ? (size_t) t.value : SIZE_MAX;
+
+      if (d < q->depth) q->depth = d;
+    }
+
+    // (file kinds may be known without metadata, from the directory)
+    bool cheap = t.field == field_name || t.field == field_type || t.field == field_depth;
+
+    if (cheap) q->terms[q->n++] = t;
+    else costly[costly_n++] = t;
+
+#ifdef HAS_STATX
+    if (t.field == field_size) q->mask |= STATX_SIZE;
+    if (t.field == field_mtime) q->mask |= STATX_MTIME;
+    if (t.field == field_ctime) q->mask |= STATX_CTIME;
+    if (t.field == field_user) q->mask |= STATX_UID;
+    if (t.field == field_group) q->mask |= STATX_GID;
+    if (t.field == field_mode) q->mask |= STATX_MODE;
+#endif
+  }
+
+  if (q->n + costly_n == 0) {
+    snprintf(err, err_len, "empty query");
+    free(q);
+    return NULL;
+  }
+
+  q->cheap = q->n;
+
+  memcpy(q->terms + q->n, costly, costly_n*sizeof(QueryTerm));
+  q->n += costly_n;
+
+  return q;
+}
+
+
+size_t query_depth(const Query* q) {
+  return q->depth;
+}
+
+
+// the kind of entry (type is what the directory says, DT_UNKNOWN if it doesn't)
+static
+int64_t entry_kind(int dir_fd, const char* name, unsigned char type) {
+  if (type == DT_UNKNOWN) {
+    struct stat info;
+
+    if (fstatat(dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) return -1;
+
+    type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISLNK(info.st_mode) ? DT_LNK : DT_REG;
+  }
+
+  return type == DT_DIR ? kind_dir : type == DT_LNK ? kind_link : kind_file;
+}
+
+
+bool query_test(const Query* q, int dir_fd, const char* name, unsigned char type, size_t depth) {
+  int64_t kind = -2;
+  size_t i = 0;
+
+  for (; i < q->cheap; i++) {
+    const QueryTerm* t = &q->terms[i];
+    bool ok = false;
+
+    if (t->field == field_name)
+      ok = (fnmatch(t->pattern, name, 0) == 0) == (t->op == op_eq);
+
+    else if (t->field == field_depth)
+      ok = compare(depth, t->op, t->value);
+
+    else if (t->value >= kind_file) {
+      if (kind == -2) kind = entry_kind(dir_fd, name, type);
+      ok = (kind == t->value) == (t->op == op_eq);
+    }
+    else {
+      const char* ext = name + path_get_extension(name, strlen(name));
+      ok = ((int64_t) get_file_type(ext) == t->value) == (t->op == op_eq);
+    }
+
+    if (!ok) return false;
+  }
+
+  if (i == q->n) return true;
+
+  // only the fields the other terms need are asked for (not following links)
+  int64_t size, mtime, ctime, uid, gid, mode;
+
+#ifdef HAS_STATX
+  struct statx stx;
+
+  if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, q->mask, &stx) != 0) return false;
+
+  size = stx.stx_size;
+  mtime = stx.stx_mtime.tv_sec;
+  ctime = stx.stx_ctime.tv_sec;
+  uid = stx.stx_uid;
+  gid = stx.stx_gid;
+  mode = stx.stx_mode & 07777;
+#else
+  struct stat info;
+
+  if (fstatat(dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) return false;
+
+  size = info.st_size;
+  mtime = info.st_mtime;
+  ctime = info.st_ctime;
+  uid = info.st_uid;
+  gid = info.st_gid;
+  mode = info.st_mode & 07777;
+#endif
+
+  for (; i < q->n; i++) {
+    const QueryTerm* t = &q->terms[i];
+    int64_t v = 0;
+
+    switch (t->field) {
+    case field_size:  v = size; break;
+    case field_mtime: v = q->now - mtime; break;
+    case field_ctime: v = q->now - ctime; break;
+    case field_user:  v = uid; break;
+    case field_group: v = gid; break;
+    case field_mode:  v = mode; break;
+    default: break;
+    }
+
+    if (!compare(v, t->op, t->value)) return false;
+  }
+
+  return true;
+}
+
+
+void query_free(Query* q) {
+  free(q);
+}
@@ -40,11 +40,9 @@ WINDOW*  WLFT = NULL;
 WINDOW*  WRGT = NULL;
 
 State*   STATE     = NULL;
-Entry*   ENTRIES   = NULL;
 Config*  CONFIG    = NULL;
 Preview* PREVIEW   = NULL;
-BTNode*  HISTORY   = NULL;
-BTNode*  SELECTION = NULL;
+KeyMap*  HISTORY   = NULL;
 
 char     HOST[256] = "";
 char     USER[256] = "";
@@ -110,8 +108,11 @@ void help(void) {
   char modes[32];
   preview_get_modes(PREVIEW, sizeof(modes), modes);
 
-  printf("usage: raider [-h] [-v] [-p preview_qmode] [-s file]\n");
+  printf("usage: raider [-h] [-v] [-u] [-p preview_qmode] [-s file] [-b dir] [-x dir]...\n");
   printf("       where preview_mode is one of:%s\n", modes);
+  printf("       -u reads file metadata through io_uring (it may help on slow filesystems)\n");
+  printf("       -b times listing (with and without io_uring), sorting and classifying dir and exits\n");
+  printf("       -x indexes the paths under dir for the search (updated as they change)\n");
 }
 
 
@@ -129,9 +130,11 @@ void done(void) {
   close(IN_FD);
 #endif
 
-  if (SELECTION != NULL) btree_free(SELECTION);
-  if (HISTORY != NULL) btree_free(HISTORY);
-  if (ENTRIES != NULL) free(ENTRIES);
+  selection_free();
+  if (HISTORY != NULL) keymap_free(HISTORY, true);
+  list_dir_free();
+  tree_index_free();
+  frecency_close();
   if (PREVIEW != NULL) free(PREVIEW);
   if (CONFIG != NULL) free(CONFIG);
 }
@@ -154,12 +157,13 @@ int main(int argc, char* argv[]) {
 
   char preview_mode[8] = "none";
   char start_path[PATH_MAX] = "";
+  bool use_uring = false;
 
   PREVIEW = (Preview*) malloc(sizeof(Preview));
   preview_init(PREVIEW);
 
   int opt;
-  while ((opt = getopt(argc, argv, "hvp:s:")) != -1) {
+  while ((opt = getopt(argc, argv, "hvup:s:b:x:")) != -1) {
     if (opt == 'h') {
       help();
       return EXIT_SUCCESS;
@@ -168,6 +172,16 @@ int main(int argc, char* argv[]) {
       printf("raider version %s\n", RAIDER_VERSION);
       return EXIT_SUCCESS;
     }
+    else if (opt == 'u')
+      use_uring = true;
+    else if (opt == 'b')
+      return benchmark(optarg);
+    else if (opt == 'x') {
+      if (!tree_index_add(optarg)) {
+        fprintf(stderr, "cannot index directory %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+    }
     else if (opt == 'p')
       strlcpy(preview_mode, optarg, sizeof(preview_mode));
     else if (opt == 's') {
@@ -222,8 +236,13 @@ int main(int argc, char* argv[]) {
   CONFIG = (Config*) malloc(sizeof(Config));
   config_init(CONFIG);
 
-  HISTORY = btree_new(0);
-  SELECTION = btree_new(0);
+  // (the synchronous path is as fast on local disks)
+  list_dir_use_uring(use_uring);
+
+  if (use_uring && !list_dir_uses_uring())
+    fprintf(stderr, "io_uring is not available, reading metadata synchronously\n");
+
+  HISTORY = keymap_new();
 
   strlcpy(USER, getenv("USER"), sizeof(USER));
   gethostname(HOST, sizeof(HOST));
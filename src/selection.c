@@ -0,0 +1,548 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include "keymap.h"
+#include "raider.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a selected file: its directory (in the directory table) and its name
+typedef struct {
+  uint32_t    dir;
+  bool        saved;                 // it's in the selection file
+  const char* name;
+} SelItem;
+
+// selected files (by device and inode), the items and names are in the arena
+static KeyMap* SELECTED = NULL;
+static Arena SEL_ARENA;
+static size_t SEL_DEAD = 0;          // items in the arena no longer selected
+
+// directories of selected files (interned: open addressing, id+1 in used slots)
+static const char** DIRS = NULL;
+static size_t DIRS_N = 0;
+static size_t DIRS_CAP = 0;
+static uint32_t* DIRS_INDEX = NULL;
+static size_t DIRS_INDEX_CAP = 0;
+static Arena DIRS_ARENA;
+
+// the selection file is kept as the selection changes: files selected since it
+// was written are appended to it, it's written anew only when some file in it
+// was deselected (or it's not what was written)
+static KMKey* UNSAVED = NULL;        // files selected since the last save (some may be gone)
+static size_t UNSAVED_N = 0;
+static size_t UNSAVED_CAP = 0;
+static bool SEL_FILE_STALE = false;  // it has files no longer selected
+static off_t SEL_FILE_SIZE = -1;     // its size when written (-1 if it's not)
+
+// files checked per io_uring batch (when purging)
+#define PURGE_BATCH 256
+
+// a bit per entry shown (for bulk selection)
+static uint64_t* MARKS = NULL;
+static size_t MARKS_CAP = 0;         // words
+
+
+// get the id of a directory (it's added if it's not there), UINT32_MAX if there's no memory for it
+static
+uint32_t dir_intern(const char* dir, size_t len) {
+  if (2*(DIRS_N + 1) > DIRS_INDEX_CAP) {
+    size_t cap = DIRS_INDEX_CAP > 0 ? 2*DIRS_INDEX_CAP : 256;
+    uint32_t* index = calloc(cap, sizeof(uint32_t));
+
+    if (index == NULL) return UINT32_MAX;
+
+    for (size_t i = 0; i < DIRS_N; i++) {
+      size_t s = fnv1a(DIRS[i], strlen(DIRS[i])) & (cap-1);
+      while (index[s] != 0) s = (s+1) & (cap-1);
+
+      index[s] = i + 1;
+    }
+
+    free(DIRS_INDEX);
+    DIRS_INDEX = index;
+    DIRS_INDEX_CAP = cap;
+  }
+
+  size_t s = fnv1a(dir, len) & (DIRS_INDEX_CAP-1);
+
+  for (; DIRS_INDEX[s] != 0; s = (s+1) & (DIRS_INDEX_CAP-1)) {
+    const char* d = DIRS[DIRS_INDEX[s]-1];
+
+    if (strncmp(d, dir, len) == 0 && d[len] == '\0') return DIRS_INDEX[s]-1;
+  }
+
+  if (DIRS_N == DIRS_CAP) {
+    size_t cap = DIRS_CAP > 0 ? 2*DIRS_CAP : 256;
+    const char** dirs = realloc(DIRS, cap*sizeof(const char*));
+
+    if (dirs == NULL) return UINT32_MAX;
+
+    DIRS = dirs;
+    DIRS_CAP = cap;
+  }
+
+  if ((DIRS[DIRS_N] = arena_strdup(&DIRS_ARENA, dir, len)) == NULL) return UINT32_MAX;
+
+  DIRS_INDEX[s] = ++DIRS_N;
+
+  return DIRS_N-1;
+}
+
+
+// write the path of a selected file (files in / have an empty directory)
+static
+void item_path(size_t size, char path[size], const SelItem* item) {
+  snprintf(path, size, "%s/%s", DIRS[item->dir], item->name);
+}
+
+
+static
+void* item_copy(KMKey key __attribute__((unused)), void* val, void* ctx) {
+  const SelItem* old = (const SelItem*) val;
+  SelItem* item = arena_alloc((Arena*) ctx, sizeof(SelItem));
+  char* name = item != NULL ? arena_strdup((Arena*) ctx, old->name, strlen(old->name)) : NULL;
+
+  // (it can't fail: the new arena has room for all of them already)
+  if (name == NULL) return val;
+
+  item->dir = old->dir;
+  item->saved = old->saved;
+  item->name = name;
+
+  return item;
+}
+
+
+// copy the items still selected to a new arena (once most of it is deselected ones)
+static
+void compact(void) {
+  Arena arena = { NULL, NULL };
+  size_t size = arena_size(&SEL_ARENA);
+
+  // (one block that takes them all)
+  if (arena_alloc(&arena, size) == NULL) return;
+  arena_reset(&arena);
+
+  keymap_traverse(SELECTED, item_copy, &arena);
+
+  arena_free(&SEL_ARENA);
+
+  SEL_ARENA = arena;
+  SEL_DEAD = 0;
+}
+
+
+// deselected items go all at once (when none is left) or in a compaction
+static
+void dead_check(void) {
+  if (keymap_size(SELECTED) == 0) selection_clear();
+  else if (SEL_DEAD > 4096 && SEL_DEAD > 2*keymap_size(SELECTED)) compact();
+}
+
+
+static
+bool item_add(KMKey key, uint32_t dir, const char* name) {
+  SelItem* item = arena_alloc(&SEL_ARENA, sizeof(SelItem));
+
+  if (dir == UINT32_MAX || item == NULL) return false;
+
+  item->dir = dir;
+  item->saved = false;
+
+  if ((item->name = arena_strdup(&SEL_ARENA, name, strlen(name))) == NULL) return false;
+
+  keymap_set(SELECTED, key, item);
+
+  if (!keymap_has_key(SELECTED, key)) return false;
+
+  // (if it can't be remembered the file is written anew)
+  if (UNSAVED_N == UNSAVED_CAP) {
+    size_t cap = UNSAVED_CAP > 0 ? 2*UNSAVED_CAP : 1024;
+    KMKey* unsaved = realloc(UNSAVED, cap*sizeof(KMKey));
+
+    if (unsaved == NULL) {
+      SEL_FILE_STALE = true;
+      return true;
+    }
+
+    UNSAVED = unsaved;
+    UNSAVED_CAP = cap;
+  }
+
+  UNSAVED[UNSAVED_N++] = key;
+
+  return true;
+}
+
+
+static
+void item_drop(KMKey key, const SelItem* item) {
+  if (item->saved) SEL_FILE_STALE = true;
+
+  keymap_set(SELECTED, key, NULL);
+  SEL_DEAD++;
+}
+
+
+bool selection_add(uint64_t dev, uint64_t ino, const char* path) {
+  if (SELECTED == NULL && (SELECTED = keymap_new()) == NULL) return false;
+
+  KMKey key = keymap_key(dev, ino);
+
+  if (keymap_has_key(SELECTED, key)) return true;
+
+  const char* slash = strrchr(path, '/');
+
+  if (slash == NULL) return false;
+
+  return item_add(key, dir_intern(path, slash - path), slash + 1);
+}
+
+
+size_t selection_merge(const char* dir, size_t n, const uint64_t* bits) {
+  if (SELECTED == NULL && (SELECTED = keymap_new()) == NULL) return 0;
+
+  size_t marked = 0;
+  for (size_t w = 0; w < (n + 63)/64; w++) marked += __builtin_popcountll(bits[w]);
+
+  // (one rehash at most)
+  keymap_reserve(SELECTED, marked);
+
+  // files in / have an empty directory
+  size_t base = strcmp(dir, "/") == 0 ? 0 : strlen(dir);
+  uint32_t dir_id = dir_intern(dir, base);
+  size_t changed = 0;
+
+  for (size_t pos = 0; pos < n; pos++) {
+    const Entry* entry = entry_at(pos);
+
+    if (!entry->loaded) continue;
+
+    KMKey key = keymap_key(entry->info.dev, entry->info.ino);
+    bool want = bits[pos/64] >> (pos%64) & 1;
+
+    const SelItem* item = keymap_get(SELECTED, key);
+
+    if (want == (item != NULL)) continue;
+
+    if (!want) {
+      item_drop(key, item);
+      changed++;
+      continue;
+    }
+
+    // (entries of virtual listings are paths under dir)
+    const char* slash = strrchr(entry->name, '/');
+    uint32_t id = dir_id;
+
+    if (slash != NULL) {
+      char path[PATH_MAX];
+      int len = snprintf(path, sizeof(path), "%.*s/%.*s", (int) base, dir, (int) (slash - entry->name), entry->name);
+
+      if (len < 0 || (size_t) len >= sizeof(path)) continue;
+
+      id = dir_intern(path, len);
+    }
+
+    if (item_add(key, id, slash != NULL ? slash + 1 : entry->name)) changed++;
+  }
+
+  dead_check();
+
+  return changed;
+}
+
+
+void selection_remove(uint64_t dev, uint64_t ino) {
+  if (SELECTED == NULL) return;
+
+  KMKey key = keymap_key(dev, ino);
+  const SelItem* item = keymap_get(SELECTED, key);
+
+  if (item == NULL) return;
+
+  item_drop(key, item);
+
+  dead_check();
+}
+
+
+bool selection_has(uint64_t dev, uint64_t ino) {
+  return SELECTED != NULL && keymap_has_key(SELECTED, keymap_key(dev, ino));
+}
+
+
+size_t selection_size(void) {
+  return SELECTED != NULL ? keymap_size(SELECTED) : 0;
+}
+
+
+void selection_clear(void) {
+  if (SELECTED != NULL) keymap_free(SELECTED, false);
+
+  // (arena blocks are kept for the next selection)
+  arena_reset(&SEL_ARENA);
+  arena_reset(&DIRS_ARENA);
+
+  // (an empty file is written for an empty selection)
+  if (SEL_FILE_SIZE > 0) SEL_FILE_STALE = true;
+
+  SELECTED = NULL;
+  SEL_DEAD = 0;
+  DIRS_N = 0;
+  UNSAVED_N = 0;
+
+  if (DIRS_INDEX != NULL) memset(DIRS_INDEX, 0, DIRS_INDEX_CAP*sizeof(uint32_t));
+}
+
+
+uint64_t* selection_marks(size_t n) {
+  size_t words = (n + 63)/64;
+
+  if (words > MARKS_CAP) {
+    uint64_t* marks = realloc(MARKS, words*sizeof(uint64_t));
+
+    if (marks == NULL) return NULL;
+
+    MARKS = marks;
+    MARKS_CAP = words;
+  }
+
+  memset(MARKS, 0, words*sizeof(uint64_t));
+
+  return MARKS;
+}
+
+
+static
+void* write_selected(KMKey key __attribute__((unused)), void* val, void* ctx) {
+  char path[PATH_MAX];
+  SelItem* item = (SelItem*) val;
+
+  item_path(sizeof(path), path, item);
+  fprintf((FILE*) ctx, "%s\n", path);
+
+  item->saved = true;
+
+  return val;
+}
+
+
+static
+void file_path(size_t size, char path[size]) {
+  snprintf(path, size, "%s/.raider-sel-%i", getenv("HOME"), getpid());
+}
+
+
+void selection_save(void) {
+  char path[PATH_MAX];
+  file_path(sizeof(path), path);
+
+  // (someone else may have changed it meanwhile)
+  struct stat info;
+  bool rewrite = SEL_FILE_STALE || SEL_FILE_SIZE < 0 || stat(path, &info) != 0 || info.st_size != SEL_FILE_SIZE;
+
+  FILE* f = fopen(path, rewrite ? "w" : "a");
+  if (f == NULL)  return;
+
+  if (rewrite) {
+    if (SELECTED != NULL) keymap_traverse(SELECTED, write_selected, f);
+  }
+  else {
+    for (size_t i = 0; i < UNSAVED_N; i++) {
+      SelItem* item = keymap_get(SELECTED, UNSAVED[i]);
+
+      if (item != NULL && !item->saved) write_selected(UNSAVED[i], item, f);
+    }
+  }
+
+  UNSAVED_N = 0;
+  SEL_FILE_STALE = false;
+  SEL_FILE_SIZE = fflush(f) == 0 && fstat(fileno(f), &info) == 0 ? info.st_size : -1;
+
+  fclose(f);
+}
+
+
+// a selected file (to check if it's still there)
+typedef struct {
+  KMKey          key;
+  const SelItem* item;
+} PurgeItem;
+
+typedef struct {
+  PurgeItem* items;
+  size_t*    next;                   // where the next file of each directory goes
+} PurgeCtx;
+
+
+static
+void* purge_count(KMKey key __attribute__((unused)), void* val, void* ctx) {
+  ((PurgeCtx*) ctx)->next[((const SelItem*) val)->dir + 1]++;
+  return val;
+}
+
+
+static
+void* purge_place(KMKey key, void* val, void* ctx) {
+  PurgeCtx* purge = (PurgeCtx*) ctx;
+  const SelItem* item = (const SelItem*) val;
+
+  purge->items[purge->next[item->dir]++] = (PurgeItem) { key, item };
+
+  return val;
+}
+
+
+// check which of n files of a directory are there (found[i] is set for them)
+static
+void purge_check(const char* dir, size_t n, const PurgeItem* items, bool* found) {
+#ifdef O_PATH
+  int dir_fd = open(dir[0] != '\0' ? dir : "/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+  int dir_fd = open(dir[0] != '\0' ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+
+  // (a directory that can't be opened may still let its files be looked at)
+  if (dir_fd < 0) {
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < n; i++) {
+      item_path(sizeof(path), path, items[i].item);
+      found[i] = path_exists(path);
+    }
+
+    return;
+  }
+
+  size_t i = 0;
+
+#if defined(__linux__) && defined(STATX_TYPE)
+  // the files of big directories are looked at in batches
+  if (n >= 8 && list_dir_uses_uring()) {
+    const char* names[PURGE_BATCH];
+    int flags[PURGE_BATCH];
+    int res[PURGE_BATCH];
+    static struct statx bufs[PURGE_BATCH];
+
+    for (; i < n; ) {
+      size_t k = n - i < PURGE_BATCH ? n - i : PURGE_BATCH;
+
+      for (size_t j = 0; j < k; j++) {
+        names[j] = items[i+j].item->name;
+        flags[j] = AT_STATX_DONT_SYNC;
+      }
+
+      if (uring_statx(dir_fd, k, names, flags, STATX_TYPE, bufs, res) < 0) break;
+
+      for (size_t j = 0; j < k; j++) found[i+j] = res[j] >= 0;
+
+      i += k;
+    }
+  }
+#endif
+
+  struct stat info;
+
+  for (; i < n; i++) found[i] = fstatat(dir_fd, items[i].item->name, &info, 0) == 0;
+
+  close(dir_fd);
+}
+
+
+void selection_purge(void) {
+  size_t n = SELECTED != NULL ? keymap_size(SELECTED) : 0;
+  PurgeItem* items = n > 0 ? malloc(n*sizeof(PurgeItem)) : NULL;
+  size_t* next = n > 0 ? calloc(DIRS_N + 1, sizeof(size_t)) : NULL;
+  bool* found = n > 0 ? malloc(n*sizeof(bool)) : NULL;
+  size_t removed = 0;
+
+  if (n > 0 && items != NULL && next != NULL && found != NULL) {
+    PurgeCtx purge = { items, next };
+
+    // files are grouped by directory (a counting sort on it)
+    keymap_traverse(SELECTED, purge_count, &purge);
+    for (size_t d = 0; d < DIRS_N; d++) next[d+1] += next[d];
+    keymap_traverse(SELECTED, purge_place, &purge);
+
+    // (next[d] is now where the files of directory d end)
+    for (size_t d = 0, from = 0; d < DIRS_N; from = next[d++])
+      if (next[d] > from) purge_check(DIRS[d], next[d] - from, &items[from], &found[from]);
+
+    for (size_t i = 0; i < n; i++) {
+      if (!found[i]) {
+        item_drop(items[i].key, items[i].item);
+        removed++;
+      }
+    }
+
+    dead_check();
+  }
+
+  free(items);
+  free(next);
+  free(found);
+
+  if (removed > 0) selection_save();
+}
+
+
+void selection_remove_file(void) {
+  char path[PATH_MAX];
+  file_path(sizeof(path), path);
+
+  if (path_exists(path)) unlink(path);
+
+  SEL_FILE_SIZE = -1;
+}
+
+
+void selection_free(void) {
+  selection_clear();
+
+  arena_free(&SEL_ARENA);
+  arena_free(&DIRS_ARENA);
+  free(DIRS);
+  free(DIRS_INDEX);
+  free(MARKS);
+  free(UNSAVED);
+
+  UNSAVED = NULL;
+  UNSAVED_CAP = 0;
+  DIRS = NULL;
+  DIRS_INDEX = NULL;
+  MARKS = NULL;
+  DIRS_CAP = DIRS_INDEX_CAP = MARKS_CAP = 0;
+}
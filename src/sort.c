@@ -0,0 +1,624 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2024, Luca Marx
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "raider.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
+
+// directories with at least this many entries are sorted on several threads
+#define SORT_PARALLEL_MIN (64 * 1024)
+#define SORT_MAX_THREADS  8
+
+// fewer keys than this are sorted by comparison (radix passes don't pay off)
+#define RADIX_MIN 256
+
+// entries are sorted by a fixed width key extracted up front (the first bytes of
+// the name for name orders, so that most comparisons don't touch the names)
+typedef struct {
+  uint64_t    key;
+  const char* name;
+  uint32_t    idx;                   // the entry
+} SortKey;
+
+// scratch space for keys (kept from one sort to the next, like the merge buffer)
+static SortKey* SORT_KEYS = NULL;
+static size_t SORT_KEYS_CAP = 0;
+
+// what keys are extracted from
+typedef struct {
+  const Entry*       entries;
+  const char* const* collated;       // collation keys of the entries (orders that have them)
+} SortSource;
+
+// what sorting entries in some order takes
+typedef struct {
+  void (*extract)(SortKey* keys, const uint32_t* idx, size_t n, const SortSource* src);
+  void (*sort)(SortKey* keys, SortKey* tmp, size_t n);
+  void (*merge)(const SortKey* a, size_t a_n, const SortKey* b, size_t b_n, SortKey* out);
+  void (*merge_index)(uint32_t* idx, size_t n, size_t run, const SortSource* src, uint32_t* buf);
+} SortOrder;
+
+
+// first 8 bytes of name, big endian (zero padded): they compare like strcmp does
+static inline
+uint64_t name_prefix(const char* name) {
+  uint64_t key = 0;
+  int i = 0;
+
+  for (; i < 8 && name[i] != '\0'; i++) key = key << 8 | (unsigned char) name[i];
+
+  return i == 0 ? 0 : key << 8*(8-i);
+}
+
+
+static inline
+int name_cmp(const SortKey* a, const SortKey* b) {
+  if (a->key != b->key) return a->key < b->key ? -1 : 1;
+
+  // same prefix: names shorter than it are the same name
+  if ((a->key & 0xff) == 0) return 0;
+
+  return strcmp(a->name + 8, b->name + 8);
+}
+
+
+static inline
+bool name_less(const SortKey* a, const SortKey* b) {
+  return name_cmp(a, b) < 0;
+}
+
+
+// collation keys are followed by the name (past their terminator): names that
+// collate the same go by name
+static inline
+bool collated_less(const SortKey* a, const SortKey* b) {
+  int r = name_cmp(a, b);
+
+  if (r != 0) return r < 0;
+
+  return strcmp(a->name + strlen(a->name) + 1, b->name + strlen(b->name) + 1) < 0;
+}
+
+
+// signed values as keys that sort the same way
+static inline
+uint64_t signed_key(int64_t value) {
+  return (uint64_t) value ^ (UINT64_C(1) << 63);
+}
+
+
+static inline
+void name_key(SortKey* k, const SortSource* src, uint32_t i) {
+  k->key = name_prefix(src->entries[i].name);
+  k->name = src->entries[i].name;
+}
+
+
+// collation keys sort like names do
+static inline
+void collated_key(SortKey* k, const SortSource* src, uint32_t i) {
+  k->key = name_prefix(src->collated[i]);
+  k->name = src->collated[i];
+}
+
+
+static inline
+void size_asc_key(SortKey* k, const SortSource* src, uint32_t i) {
+  k->key = signed_key(src->entries[i].info.size);
+  k->name = src->entries[i].name;
+}
+
+
+static inline
+void ctime_asc_key(SortKey* k, const SortSource* src, uint32_t i) {
+  k->key = signed_key(src->entries[i].info.ctime);
+  k->name = src->entries[i].name;
+}
+
+
+#define KEY_LESS(a, b)      ((a)->key < (b)->key)
+#define NAME_ASC_LESS(a, b) name_less((a), (b))
+#define COLL_ASC_LESS(a, b) collated_less((a), (b))
+
+#define SORT_SWAP(a, b) do { SortKey t_ = (a); (a) = (b); (b) = t_; } while (0)
+
+
+// introsort and merge of keys ordered by LESS (inlined, no comparator calls)
+#define SORT_KEYS_GENERATE(suffix, LESS)                                        \
+static                                                                          \
+void insertion_sort_##suffix(SortKey* a, size_t n) {                            \
+  for (size_t i = 1; i < n; i++) {                                              \
+    SortKey t = a[i];                                                           \
+    size_t j = i;                                                               \
+                                                                                \
+    for (; j > 0 && LESS(&t, &a[j-1]); j--) a[j] = a[j-1];                      \
+                                                                                \
+    a[j] = t;                                                                   \
+  }                                                                             \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void sift_down_##suffix(SortKey* a, size_t i, size_t n) {                       \
+  for (size_t c; (c = 2*i + 1) < n; i = c) {                                    \
+    if (c + 1 < n && LESS(&a[c], &a[c+1])) c++;                                 \
+    if (!LESS(&a[i], &a[c])) return;                                            \
+    SORT_SWAP(a[i], a[c]);                                                      \
+  }                                                                             \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void heap_sort_##suffix(SortKey* a, size_t n) {                                 \
+  for (size_t i = n/2; i > 0; i--) sift_down_##suffix(a, i-1, n);               \
+                                                                                \
+  for (size_t i = n; i > 1; i--) {                                              \
+    SORT_SWAP(a[0], a[i-1]);                                                    \
+    sift_down_##suffix(a, 0, i-1);                                              \
+  }                                                                             \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void quick_sort_##suffix(SortKey* a, size_t n, int depth) {                     \
+  while (n > 16) {                                                              \
+    /* too many bad pivots: heap sort keeps it n log n */                       \
+    if (depth-- == 0) {                                                         \
+      heap_sort_##suffix(a, n);                                                 \
+      return;                                                                   \
+    }                                                                           \
+                                                                                \
+    size_t m = n/2;                                                             \
+                                                                                \
+    if (LESS(&a[m], &a[0])) SORT_SWAP(a[m], a[0]);                              \
+    if (LESS(&a[n-1], &a[0])) SORT_SWAP(a[n-1], a[0]);                          \
+    if (LESS(&a[n-1], &a[m])) SORT_SWAP(a[n-1], a[m]);                          \
+                                                                                \
+    SortKey p = a[m];                                                           \
+    size_t i = 0, j = n-1;                                                      \
+                                                                                \
+    for (;;) {                                                                  \
+      while (LESS(&a[i], &p)) i++;                                              \
+      while (LESS(&p, &a[j])) j--;                                              \
+                                                                                \
+      if (i >= j) break;                                                        \
+                                                                                \
+      SORT_SWAP(a[i], a[j]);                                                    \
+      i++;                                                                      \
+      j--;                                                                      \
+    }                                                                           \
+                                                                                \
+    /* recurse into the smaller part, loop on the bigger one */                 \
+    if (j + 1 < n - j - 1) {                                                    \
+      quick_sort_##suffix(a, j + 1, depth);                                     \
+      a += j + 1;                                                               \
+      n -= j + 1;                                                               \
+    }                                                                           \
+    else {                                                                      \
+      quick_sort_##suffix(a + j + 1, n - j - 1, depth);                         \
+      n = j + 1;                                                                \
+    }                                                                           \
+  }                                                                             \
+                                                                                \
+  insertion_sort_##suffix(a, n);                                                \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void sort_keys_##suffix(SortKey* keys, SortKey* tmp __attribute__((unused)), size_t n) { \
+  int depth = 0;                                                                \
+  for (size_t m = n; m > 1; m /= 2) depth += 2;                                 \
+                                                                                \
+  quick_sort_##suffix(keys, n, depth);                                          \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void merge_keys_##suffix(const SortKey* a, size_t a_n, const SortKey* b, size_t b_n, SortKey* out) { \
+  size_t i = 0, j = 0, k = 0;                                                   \
+                                                                                \
+  while (i < a_n && j < b_n) out[k++] = LESS(&b[j], &a[i]) ? b[j++] : a[i++];   \
+  while (i < a_n) out[k++] = a[i++];                                            \
+  while (j < b_n) out[k++] = b[j++];                                            \
+}
+
+
+// key extraction for an order and merging of sort index runs in it (keys are
+// extracted on the fly for the heads of the runs)
+#define SORT_ORDER_GENERATE(suffix, KEY, LESS)                                  \
+static                                                                          \
+void extract_##suffix(SortKey* keys, const uint32_t* idx, size_t n, const SortSource* src) { \
+  for (size_t i = 0; i < n; i++) {                                              \
+    KEY(&keys[i], src, idx[i]);                                                 \
+    keys[i].idx = idx[i];                                                       \
+  }                                                                             \
+}                                                                               \
+                                                                                \
+static                                                                          \
+void merge_index_##suffix(uint32_t* idx, size_t n, size_t run, const SortSource* src, uint32_t* buf) { \
+  memcpy(buf, idx, n*sizeof(uint32_t));                                         \
+                                                                                \
+  /* the destination never overtakes the second run */                          \
+  size_t i = 0, j = n, k = 0;                                                   \
+  SortKey a = { 0 }, b = { 0 };                                                 \
+                                                                                \
+  if (i < n) KEY(&a, src, buf[i]);                                              \
+  if (j < n + run) KEY(&b, src, idx[j]);                                        \
+                                                                                \
+  while (i < n) {                                                               \
+    if (j < n + run && LESS(&b, &a)) {                                          \
+      idx[k++] = idx[j++];                                                      \
+      if (j < n + run) KEY(&b, src, idx[j]);                                    \
+    }                                                                           \
+    else {                                                                      \
+      idx[k++] = buf[i++];                                                      \
+      if (i < n) KEY(&a, src, buf[i]);                                          \
+    }                                                                           \
+  }                                                                             \
+}
+
+
+SORT_KEYS_GENERATE(name_asc, NAME_ASC_LESS)
+SORT_KEYS_GENERATE(coll_asc, COLL_ASC_LESS)
+SORT_KEYS_GENERATE(num, KEY_LESS)
+
+SORT_ORDER_GENERATE(name_asc, name_key, NAME_ASC_LESS)
+SORT_ORDER_GENERATE(coll_asc, collated_key, COLL_ASC_LESS)
+SORT_ORDER_GENERATE(size_asc, size_asc_key, KEY_LESS)
+SORT_ORDER_GENERATE(ctime_asc, ctime_asc_key, KEY_LESS)
+
+
+// LSD radix sort on the keys, a byte at a time (bytes that are the same for all
+// keys are skipped, usually the upper ones), stable
+static
+void radix_sort(SortKey* keys, SortKey* tmp, size_t n) {
+  if (n < RADIX_MIN) {
+    sort_keys_num(keys, tmp, n);
+    return;
+  }
+
+  size_t count[8][256] = { { 0 } };
+
+  for (size_t i = 0; i < n; i++)
+    for (int d = 0; d < 8; d++) count[d][(keys[i].key >> 8*d) & 0xff]++;
+
+  SortKey* src = keys;
+  SortKey* dst = tmp;
+
+  for (int d = 0; d < 8; d++) {
+    if (count[d][(keys[0].key >> 8*d) & 0xff] == n) continue;
+
+    size_t sum = 0;
+    for (int b = 0; b < 256; b++) {
+      size_t c = count[d][b];
+      count[d][b] = sum;
+      sum += c;
+    }
+
+    for (size_t i = 0; i < n; i++) dst[count[d][(src[i].key >> 8*d) & 0xff]++] = src[i];
+
+    SortKey* t = src;
+    src = dst;
+    dst = t;
+  }
+
+  if (src != keys) memcpy(keys, src, n*sizeof(SortKey));
+}
+
+
+static const SortOrder ORDER_NAME_ASC  = { extract_name_asc, sort_keys_name_asc, merge_keys_name_asc, merge_index_name_asc };
+static const SortOrder ORDER_COLL_ASC  = { extract_coll_asc, sort_keys_coll_asc, merge_keys_coll_asc, merge_index_coll_asc };
+static const SortOrder ORDER_SIZE_ASC  = { extract_size_asc, radix_sort, merge_keys_num, merge_index_size_asc };
+static const SortOrder ORDER_CTIME_ASC = { extract_ctime_asc, radix_sort, merge_keys_num, merge_index_ctime_asc };
+
+
+// (descending orders are the ascending ones read backwards)
+static
+const SortOrder* get_order(char order) {
+  switch (order) {
+  case 'v':
+  case 'c': return &ORDER_COLL_ASC;
+  case 'z': return &ORDER_SIZE_ASC;
+  case 't': return &ORDER_CTIME_ASC;
+  default:  return &ORDER_NAME_ASC;
+  }
+}
+
+
+static inline
+bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+
+// natural order key: runs of digits compare by value, so they become a '0' (a
+// run sorts against anything else the way a digit does), the number of digits
+// and the digits without leading zeros (key is written as far as it fits, the
+// length is returned anyway)
+static
+size_t natural_key(size_t size, char key[size], const char* name) {
+  size_t k = 0;
+
+  while (*name != '\0') {
+    if (!is_digit(*name)) {
+      if (k + 1 < size) key[k] = *name;
+      k++;
+      name++;
+      continue;
+    }
+
+    // keep the last zero of a run of zeros
+    while (*name == '0' && is_digit(name[1])) name++;
+
+    const char* run = name;
+    while (is_digit(*name)) name++;
+
+    size_t len = name - run;
+
+    if (k + 2 + len < size) {
+      key[k] = '0';
+      key[k+1] = (char) (len < 255 ? len : 255);
+      memcpy(key + k + 2, run, len);
+    }
+
+    k += 2 + len;
+  }
+
+  if (size > 0) key[k < size ? k : size-1] = '\0';
+
+  return k;
+}
+
+
+// lowercase name (multibyte characters of the locale, bytes that aren't are taken as they are)
+static
+void fold_case(size_t size, char folded[size], const char* name) {
+  mbstate_t in, out;
+  size_t len = strlen(name), k = 0;
+
+  memset(&in, 0, sizeof(in));
+  memset(&out, 0, sizeof(out));
+
+  while (len > 0 && k + MB_LEN_MAX < size) {
+    // ASCII is the same in every locale (and most names are just that)
+    if ((unsigned char) *name < 0x80) {
+      folded[k++] = (char) tolower((unsigned char) *name);
+      name++;
+      len--;
+      continue;
+    }
+
+    wchar_t wc;
+    size_t r = mbrtowc(&wc, name, len, &in);
+
+    if (r == (size_t) -1 || r == (size_t) -2 || r == 0) {
+      memset(&in, 0, sizeof(in));
+      folded[k++] = (char) tolower((unsigned char) *name);
+      name++;
+      len--;
+      continue;
+    }
+
+    size_t w = wcrtomb(folded + k, (wchar_t) towlower((wint_t) wc), &out);
+
+    if (w == (size_t) -1) {
+      memset(&out, 0, sizeof(out));
+      memcpy(folded + k, name, r);
+      w = r;
+    }
+
+    k += w;
+    name += r;
+    len -= r;
+  }
+
+  folded[k] = '\0';
+}
+
+
+char sort_key_kind(char order) {
+  switch (order) {
+  case 'v':
+  case 'V': return 'v';
+  case 'c':
+  case 'C': return 'c';
+  default:  return 0;
+  }
+}
+
+
+size_t sort_collation_key(size_t size, char key[size], const char* name, char kind) {
+  size_t len;
+
+  if (kind == 'v') len = natural_key(size, key, name);
+  else {
+    char folded[2*strlen(name) + MB_LEN_MAX + 1];
+
+    fold_case(sizeof(folded), folded, name);
+    len = strxfrm(key, folded, size);
+  }
+
+  // the name follows the key (to order names that collate the same)
+  size_t name_len = strlen(name);
+
+  if (len + 1 + name_len < size) memcpy(key + len + 1, name, name_len + 1);
+
+  return len + 1 + name_len;
+}
+
+
+// number of threads to sort with (a power of 2)
+static
+size_t sort_threads(void) {
+  static size_t threads = 0;
+
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = 1;
+    while (threads*2 <= (size_t) cpus && threads*2 <= SORT_MAX_THREADS) threads *= 2;
+  }
+
+  return threads;
+}
+
+
+// a part of the keys to extract and sort, or two sorted parts to merge
+typedef struct {
+  const SortOrder*  order;
+  const SortSource* src;
+  const uint32_t*   idx;
+  SortKey*          keys;
+  SortKey*          tmp;             // scratch space (where merged keys go)
+  size_t            n;
+  const SortKey*    other;           // the part to merge with (of other_n keys)
+  size_t            other_n;
+} SortJob;
+
+
+static
+void* sort_job(void* arg) {
+  SortJob* job = (SortJob*) arg;
+
+  job->order->extract(job->keys, job->idx, job->n, job->src);
+  job->order->sort(job->keys, job->tmp, job->n);
+
+  return NULL;
+}
+
+
+static
+void* merge_job(void* arg) {
+  SortJob* job = (SortJob*) arg;
+
+  job->order->merge(job->keys, job->n, job->other, job->other_n, job->tmp);
+
+  return NULL;
+}
+
+
+// run jobs on threads (the first one, and any that cannot be started, on this one)
+static
+void run_jobs(void* (*fn)(void*), size_t n, SortJob jobs[n]) {
+  pthread_t threads[SORT_MAX_THREADS];
+  bool started[SORT_MAX_THREADS] = { false };
+
+  for (size_t t = 1; t < n; t++)
+    started[t] = pthread_create(&threads[t], NULL, fn, &jobs[t]) == 0;
+
+  fn(&jobs[0]);
+
+  for (size_t t = 1; t < n; t++)
+    if (started[t]) pthread_join(threads[t], NULL);
+    else fn(&jobs[t]);
+}
+
+
+bool sort_index(uint32_t* idx, size_t n, const Entry* entries, const char* const* collated, char order) {
+  if (n < 2) return true;
+
+  if (2*n > SORT_KEYS_CAP) {
+    SortKey* tmp = realloc(SORT_KEYS, 2*n*sizeof(SortKey));
+
+    if (tmp == NULL) return false;
+
+    SORT_KEYS = tmp;
+    SORT_KEYS_CAP = 2*n;
+  }
+
+  SortKey* keys = SORT_KEYS;
+  SortKey* tmp = SORT_KEYS + n;
+
+  const SortOrder* o = get_order(order);
+  const SortSource source = { entries, collated };
+  size_t threads = n >= SORT_PARALLEL_MIN ? sort_threads() : 1;
+  size_t bounds[SORT_MAX_THREADS+1];
+  SortJob jobs[SORT_MAX_THREADS];
+
+  for (size_t t = 0; t <= threads; t++) bounds[t] = n*t/threads;
+
+  // every thread sorts a part of the keys
+  for (size_t t = 0; t < threads; t++)
+    jobs[t] = (SortJob) {
+      .order   = o,
+      .src     = &source,
+      .idx     = idx + bounds[t],
+      .keys    = keys + bounds[t],
+      .tmp     = tmp + bounds[t],
+      .n       = bounds[t+1] - bounds[t]
+    };
+
+  run_jobs(sort_job, threads, jobs);
+
+  // then sorted parts are merged pairwise, halving the threads at every round
+  SortKey* src = keys;
+  SortKey* dst = tmp;
+
+  for (size_t width = 1; width < threads; width *= 2) {
+    size_t m = 0;
+
+    for (size_t t = 0; t < threads; t += 2*width) {
+      size_t lo = bounds[t], mid = bounds[t+width], hi = bounds[t+2*width];
+
+      jobs[m++] = (SortJob) {
+        .order   = o,
+        .keys    = src + lo,
+        .n       = mid - lo,
+        .other   = src + mid,
+        .other_n = hi - mid,
+        .tmp     = dst + lo
+      };
+    }
+
+    run_jobs(merge_job, m, jobs);
+
+    SortKey* t = src;
+    src = dst;
+    dst = t;
+  }
+
+  for (size_t i = 0; i < n; i++) idx[i] = src[i].idx;
+
+  return true;
+}
+
+
+void sort_free(void) {
+  free(SORT_KEYS);
+
+  SORT_KEYS = NULL;
+  SORT_KEYS_CAP = 0;
+}
+
+
+void sort_index_merge(uint32_t* idx, size_t n, size_t run, const Entry* entries, const char* const* collated,
+                      char order, uint32_t* buf) {
+  const SortSource source = { entries, collated };
+
+  get_order(order)->merge_index(idx, n, run, &source, buf);
+}
@@ -25,19 +25,48 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "utils.h"
-#include "btree.h"
 #include "raider.h"
 
 #include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/vfs.h>
+#elif defined(__NetBSD__)
+#include <sys/statvfs.h>
+#elif defined(BSD_KQUEUE)
+#include <sys/mount.h>
+#endif
+
+// directories on file systems whose changes don't all come as kernel events are
+// polled: every POLL_MIN_MS after a change, backing off up to POLL_MAX_MS
+#define POLL_MIN_MS 250
+#define POLL_MAX_MS 8000
+
+// directories up to this size are also checked by a checksum of their entries
+// (modification times may be cached or too coarse)
+#define POLL_CHECKSUM_MAX 4096
+
+// the polled directory (empty if none)
+static char POLL_DIR[PATH_MAX] = "";
+
+static struct timespec POLL_NEXT;
+static long POLL_INTERVAL = POLL_MIN_MS;
+
+// what the directory looked like at the last poll
+static struct timespec POLL_MTIME;
+static uint64_t POLL_CHECKSUM = 0;
+static bool POLL_HAS_CHECKSUM = false;
+
 
 bool starts_with(const char* str, const char* pat) {
   size_t l_str = strlen(str);
@@ -52,18 +81,196 @@ bool starts_with(const char* str, const char* pat) {
 }
 
 
-bool is_one_of(const char* pat, const char* strs) {
-  char* r = strdup(strs);
-  char* s = r;
-  char* t;
-  while ((t = strsep(&r, ","))) {
-    if (strncmp(pat, t, strlen(pat)) == 0) {
-      free(s);
-      return true;
+uint64_t fnv1a(const char* s, size_t len) {
+  uint64_t h = UINT64_C(14695981039346656037);
+
+  for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char) s[i]) * UINT64_C(1099511628211);
+
+  return h;
+}
+
+
+// extension keys: up to 8 lowercase characters packed into an integer
+#define EXT1(a)               ((uint64_t) (a))
+#define EXT2(a,b)             ((EXT1(a) << 8) | (uint64_t) (b))
+#define EXT3(a,b,c)           ((EXT2(a,b) << 8) | (uint64_t) (c))
+#define EXT4(a,b,c,d)         ((EXT3(a,b,c) << 8) | (uint64_t) (d))
+#define EXT5(a,b,c,d,e)       ((EXT4(a,b,c,d) << 8) | (uint64_t) (e))
+#define EXT6(a,b,c,d,e,f)     ((EXT5(a,b,c,d,e) << 8) | (uint64_t) (f))
+#define EXT7(a,b,c,d,e,f,g)   ((EXT6(a,b,c,d,e,f) << 8) | (uint64_t) (g))
+#define EXT8(a,b,c,d,e,f,g,h) ((EXT7(a,b,c,d,e,f,g) << 8) | (uint64_t) (h))
+
+FileType get_file_type(const char* ext) {
+  uint64_t key = 0;
+  size_t i;
+
+  for (i = 0; ext[i] && i < 8; i++) {
+    unsigned char c = ext[i];
+
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    else if (!(c >= 'a' && c <= 'z') && !(c >= '0' && c <= '9')) return unknown;
+
+    key = (key << 8) | c;
+  }
+
+  // no extension or too long for any known one
+  if (i == 0 || ext[i]) return unknown;
+
+  switch (key) {
+  case EXT3('t','x','t'): case EXT3('o','r','g'): case EXT2('m','d'):
+  case EXT8('m','a','r','k','d','o','w','n'): case EXT3('r','s','t'): case EXT3('l','o','g'):
+  case EXT3('c','s','v'): case EXT3('t','s','v'): case EXT4('j','s','o','n'):
+  case EXT4('y','a','m','l'): case EXT3('y','m','l'): case EXT4('t','o','m','l'):
+  case EXT3('i','n','i'): case EXT3('c','f','g'): case EXT4('c','o','n','f'):
+  case EXT3('x','m','l'): case EXT3('t','e','x'): case EXT3('n','f','o'):
+  case EXT4('d','i','f','f'): case EXT5('p','a','t','c','h'):
+    return text;
+
+  case EXT1('c'): case EXT1('h'): case EXT2('c','c'):
+  case EXT3('c','p','p'): case EXT3('c','x','x'): case EXT3('h','p','p'):
+  case EXT2('h','h'): case EXT3('h','x','x'): case EXT2('p','y'):
+  case EXT2('r','b'): case EXT2('g','o'): case EXT2('r','s'):
+  case EXT4('j','a','v','a'): case EXT2('j','s'): case EXT2('t','s'):
+  case EXT3('j','s','x'): case EXT3('t','s','x'): case EXT2('s','h'):
+  case EXT4('b','a','s','h'): case EXT3('z','s','h'): case EXT4('f','i','s','h'):
+  case EXT2('p','l'): case EXT2('p','m'): case EXT3('l','u','a'):
+  case EXT3('p','h','p'): case EXT2('c','s'): case EXT5('s','w','i','f','t'):
+  case EXT2('k','t'): case EXT3('k','t','s'): case EXT5('s','c','a','l','a'):
+  case EXT2('h','s'): case EXT2('m','l'): case EXT2('e','l'):
+  case EXT4('l','i','s','p'): case EXT3('c','l','j'): case EXT3('s','q','l'):
+  case EXT1('r'): case EXT1('m'): case EXT2('m','m'):
+  case EXT3('v','i','m'): case EXT3('c','s','s'): case EXT4('s','c','s','s'):
+  case EXT4('h','t','m','l'): case EXT3('h','t','m'): case EXT5('c','m','a','k','e'):
+  case EXT2('m','k'): case EXT1('s'): case EXT3('a','s','m'):
+  case EXT3('z','i','g'): case EXT3('n','i','m'): case EXT4('d','a','r','t'):
+  case EXT3('e','r','l'): case EXT2('e','x'): case EXT3('e','x','s'):
+  case EXT2('j','l'):
+    return code;
+
+  case EXT3('p','d','f'): case EXT4('d','j','v','u'): case EXT4('e','p','u','b'):
+  case EXT2('p','s'): case EXT3('d','o','c'): case EXT4('d','o','c','x'):
+  case EXT3('o','d','t'): case EXT3('r','t','f'): case EXT3('x','l','s'):
+  case EXT4('x','l','s','x'): case EXT3('o','d','s'): case EXT3('p','p','t'):
+  case EXT4('p','p','t','x'): case EXT3('o','d','p'):
+    return document;
+
+  case EXT3('p','n','g'): case EXT3('j','p','g'): case EXT4('j','p','e','g'):
+  case EXT3('g','i','f'): case EXT3('b','m','p'): case EXT4('w','e','b','p'):
+  case EXT3('t','i','f'): case EXT4('t','i','f','f'): case EXT3('s','v','g'):
+  case EXT3('i','c','o'): case EXT4('h','e','i','c'): case EXT4('a','v','i','f'):
+  case EXT3('x','p','m'): case EXT3('p','n','m'): case EXT3('p','p','m'):
+    return image;
+
+  case EXT3('a','v','i'): case EXT3('m','k','v'): case EXT3('m','o','v'):
+  case EXT3('m','p','4'): case EXT3('m','p','g'): case EXT3('w','m','v'):
+  case EXT4('m','p','e','g'): case EXT4('w','e','b','m'): case EXT3('m','4','v'):
+  case EXT3('f','l','v'): case EXT3('3','g','p'): case EXT3('o','g','v'):
+    return video;
+
+  case EXT3('m','p','3'): case EXT4('f','l','a','c'): case EXT3('o','g','g'):
+  case EXT3('o','g','a'): case EXT4('o','p','u','s'): case EXT3('w','a','v'):
+  case EXT3('m','4','a'): case EXT3('a','a','c'): case EXT3('w','m','a'):
+  case EXT4('a','i','f','f'): case EXT3('a','p','e'): case EXT3('m','i','d'):
+  case EXT4('m','i','d','i'):
+    return audio;
+
+  case EXT3('t','a','r'): case EXT3('t','g','z'): case EXT3('z','i','p'):
+  case EXT3('r','a','r'): case EXT2('g','z'): case EXT3('b','z','2'):
+  case EXT2('x','z'): case EXT3('z','s','t'): case EXT2('7','z'):
+  case EXT3('l','z','4'): case EXT4('l','z','m','a'): case EXT3('t','b','z'):
+  case EXT4('t','b','z','2'): case EXT3('t','x','z'): case EXT4('c','p','i','o'):
+  case EXT3('d','e','b'): case EXT3('r','p','m'): case EXT3('j','a','r'):
+  case EXT3('i','s','o'):
+    return archive;
+
+  default:
+    return unknown;
+  }
+}
+
+
+// size of arena blocks (bigger allocations get a block of their own)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = (size + 7) & ~(size_t) 7;
+
+  // move on to the next (reused or new) block if this one is full
+  while (arena->cur == NULL || arena->cur->used + size > arena->cur->size) {
+    ArenaBlock* next = arena->cur != NULL ? arena->cur->next : arena->head;
+
+    if (next != NULL && next->size >= size) {
+      next->used = 0;
+      arena->cur = next;
+      continue;
+    }
+
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + block_size);
+
+    if (block == NULL) return NULL;
+
+    block->size = block_size;
+    block->used = 0;
+
+    // insert after the current block (blocks too small to reuse get skipped)
+    if (arena->cur == NULL) {
+      block->next = arena->head;
+      arena->head = block;
+    }
+    else {
+      block->next = arena->cur->next;
+      arena->cur->next = block;
     }
+
+    arena->cur = block;
   }
-  free(s);
-  return false;
+
+  void* ptr = arena->cur->data + arena->cur->used;
+  arena->cur->used += size;
+
+  return ptr;
+}
+
+
+char* arena_strdup(Arena* arena, const char* str, size_t len) {
+  char* s = arena_alloc(arena, len+1);
+
+  if (s == NULL) return NULL;
+
+  memcpy(s, str, len);
+  s[len] = '\0';
+
+  return s;
+}
+
+
+void arena_reset(Arena* arena) {
+  if (arena->head != NULL) arena->head->used = 0;
+  arena->cur = arena->head;
+}
+
+
+void arena_free(Arena* arena) {
+  ArenaBlock* b = arena->head;
+
+  while (b != NULL) {
+    ArenaBlock* next = b->next;
+    free(b);
+    b = next;
+  }
+
+  arena->head = arena->cur = NULL;
+}
+
+
+size_t arena_size(const Arena* arena) {
+  size_t size = 0;
+
+  for (const ArenaBlock* b = arena->head; b != NULL; b = b->next)
+    size += sizeof(ArenaBlock) + b->size;
+
+  return size;
 }
 
 
@@ -159,19 +366,12 @@ void get_mime_type(size_t mimesz, char mime[mimesz], const Entry* file_entry) {
 }
 
 
-void path_get_extension(size_t extsz, char ext[extsz], const char* file_name) {
-  for (size_t i = strlen(file_name), j = 0; i > 0 && j <= extsz; i--, j++) {
-    if (file_name[i-1] == '.') {
-      strlcpy(ext, &file_name[i], extsz);
-      ext[extsz+1] = '\0';
-
-      for(int k = 0; ext[k]; k++)
-        ext[k] = tolower(ext[k]);
+size_t path_get_extension(const char* file_name, size_t len) {
+  // only the last 10 characters are looked at
+  for (size_t i = len, j = 0; i > 0 && j <= 10; i--, j++)
+    if (file_name[i-1] == '.') return i;
 
-      return;
-    }
-  }
-  ext[0] = '\0';
+  return len;
 }
 
 
@@ -181,6 +381,22 @@ bool path_exists(const char* path) {
 }
 
 
+bool cache_dir(size_t size, char path[size]) {
+  const char* home = getenv("HOME");
+
+  if (home == NULL) return false;
+
+  // (~/.cache may not be there either)
+  snprintf(path, size, "%s/.cache", home);
+  mkdir(path, S_IRWXU);
+
+  snprintf(path, size, "%s/.cache/raider", home);
+  mkdir(path, S_IRWXU);
+
+  return true;
+}
+
+
 void escape_quote(size_t escsz, char esc[escsz], const char* buf) {
   // single quote escape: abc'def -> abc'\''def
   for (size_t i = 0, j = 0; i < strlen(buf); i++) {
@@ -204,19 +420,19 @@ void escape_quote(size_t escsz, char esc[escsz], const char* buf) {
 
 
 void get_size_line(size_t sizesz, char size[sizesz], const Entry* entry) {
-  if (entry->info.st_size < 1e3) {
-    snprintf(size, sizesz, "%lliB", (unsigned long long int) entry->info.st_size);
+  if (entry->info.size < 1e3) {
+    snprintf(size, sizesz, "%lliB", (unsigned long long int) entry->info.size);
   }
-  else if (entry->info.st_size < 1e6) {
-    double sz = entry->info.st_size / 1000.0;
+  else if (entry->info.size < 1e6) {
+    double sz = entry->info.size / 1000.0;
     snprintf(size, sizesz, "%.1fKB", sz);
   }
-  else if (entry->info.st_size < 1e9) {
-    double sz = entry->info.st_size / 1000000.0;
+  else if (entry->info.size < 1e9) {
+    double sz = entry->info.size / 1000000.0;
     snprintf(size, sizesz, "%.1fMB", sz);
   }
   else {
-    double sz = entry->info.st_size / 1000000000.0;
+    double sz = entry->info.size / 1000000000.0;
     snprintf(size, sizesz, "%.1fGB", sz);
   }
 }
@@ -224,23 +440,23 @@ void get_size_line(size_t sizesz, char size[sizesz], const Entry* entry) {
 
 void get_mode_line(char* mode, const Entry* entry) {
   if (entry->is_link)                     mode[0] = 'l';
-  else if (S_ISREG(entry->info.st_mode))  mode[0] = '-';
-  else if (S_ISDIR(entry->info.st_mode))  mode[0] = 'd';
-  else if (S_ISCHR(entry->info.st_mode))  mode[0] = 'c';
-  else if (S_ISBLK(entry->info.st_mode))  mode[0] = 'b';
-  else if (S_ISFIFO(entry->info.st_mode)) mode[0] = 'f';
-
-  if (entry->info.st_mode & S_IRUSR) mode[1] = 'r';
-  if (entry->info.st_mode & S_IWUSR) mode[2] = 'w';
-  if (entry->info.st_mode & S_IXUSR) mode[3] = 'x';
-
-  if (entry->info.st_mode & S_IRGRP) mode[4] = 'r';
-  if (entry->info.st_mode & S_IWGRP) mode[5] = 'w';
-  if (entry->info.st_mode & S_IXGRP) mode[6] = 'x';
-
-  if (entry->info.st_mode & S_IROTH) mode[7] = 'r';
-  if (entry->info.st_mode & S_IWOTH) mode[9] = 'w';
-  if (entry->info.st_mode & S_IXOTH) mode[9] = 'x';
+  else if (S_ISREG(entry->info.mode))  mode[0] = '-';
+  else if (S_ISDIR(entry->info.mode))  mode[0] = 'd';
+  else if (S_ISCHR(entry->info.mode))  mode[0] = 'c';
+  else if (S_ISBLK(entry->info.mode))  mode[0] = 'b';
+  else if (S_ISFIFO(entry->info.mode)) mode[0] = 'f';
+
+  if (entry->info.mode & S_IRUSR) mode[1] = 'r';
+  if (entry->info.mode & S_IWUSR) mode[2] = 'w';
+  if (entry->info.mode & S_IXUSR) mode[3] = 'x';
+
+  if (entry->info.mode & S_IRGRP) mode[4] = 'r';
+  if (entry->info.mode & S_IWGRP) mode[5] = 'w';
+  if (entry->info.mode & S_IXGRP) mode[6] = 'x';
+
+  if (entry->info.mode & S_IROTH) mode[7] = 'r';
+  if (entry->info.mode & S_IWOTH) mode[9] = 'w';
+  if (entry->info.mode & S_IXOTH) mode[9] = 'x';
 }
 
 
@@ -262,47 +478,124 @@ void update_titlebar(void) {
 }
 
 
+// check if changes to dir may be made where the kernel doesn't see them
+// (network and FUSE file systems)
 static
-void* write_selected(BTKey k __attribute__((unused)), void* val, void* ctx) {
-  fprintf((FILE*) ctx, "%s\n", (char*) val);
-  return val;
-}
+bool path_is_remote(const char* dir __attribute__((unused))) {
+#if defined(__linux__)
+  struct statfs fs;
+
+  if (statfs(dir, &fs) != 0) return false;
+
+  switch ((unsigned long) fs.f_type) {
+  case 0x6969:     // nfs
+  case 0x517b:     // smb
+  case 0xff534d42: // cifs
+  case 0xfe534d42: // smb2
+  case 0x65735546: // fuse
+  case 0x00c36400: // ceph
+  case 0x01021997: // 9p
+  case 0x5346414f: // afs
+  case 0x73757245: // coda
+  case 0x564c:     // ncp
+  case 0x01161970: // gfs2
+  case 0x7461636f: // ocfs2
+  case 0x0bd00bd0: // lustre
+  case 0x47504653: // gpfs
+    return true;
+  default:
+    return false;
+  }
+#elif defined(__NetBSD__) || defined(BSD_KQUEUE)
+#if defined(__NetBSD__)
+  struct statvfs fs;
 
+  if (statvfs(dir, &fs) != 0) return false;
+#else
+  struct statfs fs;
 
-void selection_save(void) {
-  char path[PATH_MAX];
-  snprintf(path, sizeof(path), "%s/.raider-sel-%i", getenv("HOME"), getpid());
+  if (statfs(dir, &fs) != 0) return false;
+#endif
 
-  FILE* f = fopen(path, "w");
-  if (f == NULL)  return;
+  const char* remote[] = { "nfs", "smbfs", "cifs", "afpfs", "webdav", "9p", "fuse", "fusefs", "osxfuse", "macfuse" };
 
-  btree_traverse(SELECTION, write_selected, f);
+  for (size_t i = 0; i < sizeof(remote)/sizeof(remote[0]); i++)
+    if (strcmp(fs.f_fstypename, remote[i]) == 0) return true;
 
-  fclose(f);
+  return false;
+#else
+  return false;
+#endif
 }
 
 
+// checksum of directory entry names (in whatever order they come), returns false
+// if the directory is too big
 static
-void* remove_dangling(BTKey k __attribute__((unused)), void* val, void* ctx __attribute__((unused))) {
-  char* path = (char*) val;
-  if (!path_exists(path)) {
-    free(path);
-    return NULL;
+bool dir_checksum(const char* dir, uint64_t* sum) {
+  DirReader reader;
+
+  if (dir_reader_open(&reader, dir) < 0) return false;
+
+  const char* name;
+  unsigned char type;
+  size_t n = 0;
+
+  *sum = 0;
+
+  while (dir_reader_next(&reader, &name, &type) && ++n <= POLL_CHECKSUM_MAX) {
+    *sum += fnv1a(name, strlen(name));
   }
-  return val;
+
+  dir_reader_close(&reader);
+
+  return n <= POLL_CHECKSUM_MAX;
 }
 
 
-void selection_purge(void) {
-  btree_traverse(SELECTION, remove_dangling, NULL);
-  selection_save();
+static
+void poll_schedule(void) {
+  clock_gettime(CLOCK_MONOTONIC, &POLL_NEXT);
+
+  POLL_NEXT.tv_sec += POLL_INTERVAL/1000;
+  POLL_NEXT.tv_nsec += (POLL_INTERVAL%1000)*1000000;
+
+  if (POLL_NEXT.tv_nsec >= 1000000000) {
+    POLL_NEXT.tv_sec++;
+    POLL_NEXT.tv_nsec -= 1000000000;
+  }
 }
 
-void selection_remove_file(void) {
-  char path[PATH_MAX];
-  snprintf(path, sizeof(path), "%s/.raider-sel-%i", getenv("HOME"), getpid());
 
-  if (path_exists(path)) unlink(path);
+// check the polled directory (if it's time to), returns true if it changed
+static
+bool poll_dir(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (now.tv_sec < POLL_NEXT.tv_sec || (now.tv_sec == POLL_NEXT.tv_sec && now.tv_nsec < POLL_NEXT.tv_nsec))
+    return false;
+
+  struct stat info;
+  uint64_t sum = 0;
+
+  bool changed = stat(POLL_DIR, &info) == 0
+    && (info.st_mtim.tv_sec != POLL_MTIME.tv_sec || info.st_mtim.tv_nsec != POLL_MTIME.tv_nsec);
+
+  if (!changed && POLL_HAS_CHECKSUM)
+    changed = dir_checksum(POLL_DIR, &sum) && sum != POLL_CHECKSUM;
+
+  if (changed) {
+    POLL_MTIME = info.st_mtim;
+    POLL_HAS_CHECKSUM = dir_checksum(POLL_DIR, &POLL_CHECKSUM);
+  }
+
+  // back off while nothing happens
+  POLL_INTERVAL = changed ? POLL_MIN_MS : (2*POLL_INTERVAL < POLL_MAX_MS ? 2*POLL_INTERVAL : POLL_MAX_MS);
+
+  poll_schedule();
+
+  return changed;
 }
 
 
@@ -319,12 +612,31 @@ void events_subscribe(const char* dir) {
 #endif
 
 #ifdef LINUX_INOTIFY
-  IN_WD = inotify_add_watch(IN_FD, dir, IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_UNMOUNT);
+  // the listing already watches dir: just add to its mask
+  IN_WD = inotify_add_watch(IN_FD, dir, IN_MASK_ADD | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                            IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE_SELF | IN_UNMOUNT);
 #endif
+
+  // kernel events only tell about changes made through this machine: other
+  // clients of network file systems have to be caught by polling
+  struct stat info;
+
+  POLL_DIR[0] = '\0';
+
+  if (path_is_remote(dir) && stat(dir, &info) == 0) {
+    strlcpy(POLL_DIR, dir, sizeof(POLL_DIR));
+
+    POLL_MTIME = info.st_mtim;
+    POLL_HAS_CHECKSUM = dir_checksum(dir, &POLL_CHECKSUM);
+    POLL_INTERVAL = POLL_MIN_MS;
+
+    poll_schedule();
+  }
 }
 
 
-void events_consume(void (*on_dir_change)(void), void (*on_dir_unavailable)(void)) {
+void events_consume(void (*on_dir_change)(void), void (*on_entry_change)(const char*, bool),
+                    void (*on_dir_unavailable)(void)) {
 #ifdef BSD_KQUEUE
   if (KQ_FD != -1) {
     struct kevent event;
@@ -344,21 +656,41 @@ void events_consume(void (*on_dir_change)(void), void (*on_dir_unavailable)(void
     char buf[IN_EVENT_BUF_LEN];
     int nev = read(IN_FD, buf, IN_EVENT_BUF_LEN);
 
+    bool reload = false, unavailable = false;
+
     if (nev > 0) {
       int i = 0;
       while (i < nev) {
         struct inotify_event *event = (struct inotify_event*) &buf[i];
-        if (event->len) {
-          if      (event->mask & IN_CREATE)      on_dir_change();
-          else if (event->mask & IN_DELETE)      on_dir_change();
-          else if (event->mask & IN_UNMOUNT)     on_dir_unavailable();
-          else if (event->mask & IN_DELETE_SELF) on_dir_unavailable();
+
+        if (event->mask & IN_Q_OVERFLOW) {
+          // events were lost: nothing can be trusted
+          list_cache_invalidate(-1);
+          reload = true;
+        }
+        else if (event->wd != IN_WD)
+          // a change in a cached directory
+          list_cache_invalidate(event->wd);
+        else if (event->mask & (IN_UNMOUNT | IN_DELETE_SELF))
+          unavailable = true;
+        else if (event->len) {
+          if      (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            on_entry_change(event->name, true);
+          else if (event->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY))
+            on_entry_change(event->name, false);
         }
         i += IN_EVENT_SIZE + event->len;
       }
     }
+
+    if      (unavailable) on_dir_unavailable();
+    else if (reload)      on_dir_change();
   }
 #endif
+
+  // changes found by polling are looked for by reading the directory again
+  if (POLL_DIR[0] != '\0' && !list_dir_reading() && poll_dir() && !list_dir_rescan(on_entry_change))
+    on_dir_change();
 }
 
 
@@ -371,7 +703,10 @@ void events_unsubscribe(void) {
 #endif
 
 #ifdef LINUX_INOTIFY
-  if (IN_WD != -1) inotify_rm_watch(IN_FD, IN_WD);
+  // the listing keeps its watch (for the cache)
+  if (IN_WD != -1 && !list_dir_watching(IN_WD)) inotify_rm_watch(IN_FD, IN_WD);
   IN_WD = -1;
 #endif
+
+  POLL_DIR[0] = '\0';
 }